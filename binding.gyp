@@ -73,6 +73,22 @@
       ],
       'sources': [
         'src/glfw.cc',
+        'src/accumulation.cc',
+        'src/colormap.cc',
+        'src/depth_colorizer.cc',
+        'src/depth_mesh.cc',
+        'src/decimation.cc',
+        'src/deproject.cc',
+        'src/gpu_colorizer.cc',
+        'src/mosaic.cc',
+        'src/pixel_format.cc',
+        'src/point_cloud.cc',
+        'src/point_index.cc',
+        'src/point_sprites.cc',
+        'src/shader.cc',
+        'src/texture_upload.cc',
+        'src/worker_pool.cc',
+        'src/yuv.cc',
         'deps/glew-1.10.0/src/glew.c',
       ],
       'include_dirs': [
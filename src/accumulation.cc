@@ -0,0 +1,388 @@
+/*
+ * accumulation.cc
+ *
+ * A frame is merged in two steps. Points are moved into the common frame,
+ * keyed by block and cell and given their colors in bands across the worker
+ * pool; the samples are then merged into the blocks in order, which only
+ * has to look up a block when the key changes from one point to the next.
+ * Averages weigh at most kMaxWeight samples, so that voxels follow changes
+ * in the scene (and in lighting) instead of settling on the first seconds.
+ *
+ * Blocks evicted for new ones keep their index, and with it their slot in
+ * the vertex buffer. Changed slots are sorted and uploaded in runs of
+ * neighbouring slots, of which a new area being scanned mostly makes one.
+ */
+
+#include "accumulation.h"
+#include "worker_pool.h"
+#include "yuv.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace glfw {
+
+namespace {
+
+// x, y, z as floats, then rgba8
+const size_t kVertexBytes = 16;
+const uint32_t kMaxWeight = 64;
+const size_t kDefaultMaxBytes = size_t(256) << 20;
+// Fewer points than this per band are not worth splitting
+const size_t kMinBandPoints = 0x10000;
+// Blocks the block list and vertex buffer start out with
+const size_t kFirstBufferBlocks = 1024;
+const uint32_t kSkip = ~0u;
+
+// Block coordinates are biased into 21 bits each and packed into 63
+const int kAxisBits = 21;
+const int64_t kAxisBias = int64_t(1) << (kAxisBits - 1);
+const int64_t kAxisMax = (int64_t(1) << kAxisBits) - 1;
+
+inline uint64_t block_axis(int64_t cell) {
+  // Arithmetic shift, so negative cells round down too
+  const int64_t b = (cell >> 2) + kAxisBias;
+  return uint64_t(std::min(std::max<int64_t>(b, 0), kAxisMax));
+}
+
+} // namespace
+
+point_accumulator::~point_accumulator() {
+  if (vbo_)
+    glDeleteBuffers(1, &vbo_);
+}
+
+size_t point_accumulator::bytes_per_block() {
+  // The block, its slot in vertices_ and in the vertex buffer, and about
+  // what the hash map spends on an entry
+  return sizeof(block) + 2 * kBlockVoxels * kVertexBytes +
+      4 * sizeof(void*) + sizeof(GLint) + sizeof(GLsizei);
+}
+
+void point_accumulator::configure(float voxel_size, size_t max_bytes) {
+  voxel_size_ = voxel_size;
+  max_blocks_ = std::max<size_t>(1, max_bytes / bytes_per_block());
+  clear();
+}
+
+void point_accumulator::clear() {
+  blocks_.clear();
+  blocks_.shrink_to_fit();
+  block_of_.clear();
+  newest_ = oldest_ = kNone;
+  dirty_.clear();
+  vertices_.clear();
+  voxels_ = 0;
+  evicted_ = uploaded_ = 0;
+}
+
+accumulation_stats point_accumulator::stats() const {
+  accumulation_stats s;
+  s.voxels = voxels_;
+  s.blocks = blocks_.size();
+  s.memory = blocks_.size() * bytes_per_block();
+  s.max_memory = max_blocks_ * bytes_per_block();
+  s.evicted_blocks = evicted_;
+  s.uploaded_bytes = uploaded_;
+  return s;
+}
+
+void point_accumulator::unlink(uint32_t index) {
+  block& b = blocks_[index];
+  if (b.newer != kNone)
+    blocks_[b.newer].older = b.older;
+  else if (newest_ == index)
+    newest_ = b.older;
+  if (b.older != kNone)
+    blocks_[b.older].newer = b.newer;
+  else if (oldest_ == index)
+    oldest_ = b.newer;
+  b.newer = b.older = kNone;
+}
+
+void point_accumulator::touch(uint32_t index) {
+  block& b = blocks_[index];
+  if (b.frame == frame_)
+    return;
+  unlink(index);
+  b.frame = frame_;
+  b.older = newest_;
+  if (newest_ != kNone)
+    blocks_[newest_].newer = index;
+  newest_ = index;
+  if (oldest_ == kNone)
+    oldest_ = index;
+}
+
+uint32_t point_accumulator::find_block(uint64_t key) {
+  auto it = block_of_.find(key);
+  if (it != block_of_.end()) {
+    touch(it->second);
+    return it->second;
+  }
+
+  uint32_t index;
+  if (blocks_.size() < max_blocks_) {
+    // Grow by doubling, but not past the cap
+    if (blocks_.size() == blocks_.capacity())
+      blocks_.reserve(std::min(max_blocks_,
+          std::max<size_t>(blocks_.size() * 2, kFirstBufferBlocks)));
+    index = uint32_t(blocks_.size());
+    blocks_.emplace_back();
+    block& b = blocks_.back();
+    b.newer = b.older = kNone;
+    b.dirty = false;
+  } else {
+    index = oldest_;
+    unlink(index);
+    block_of_.erase(blocks_[index].key);
+    voxels_ -= blocks_[index].count;
+    evicted_++;
+  }
+  block& b = blocks_[index];
+  b.key = key;
+  b.frame = 0;
+  b.count = 0;
+  memset(b.cell_voxel, -1, sizeof(b.cell_voxel));
+  if (!b.dirty) {
+    b.dirty = true;
+    dirty_.push_back(index);
+  }
+  block_of_[key] = index;
+  touch(index);
+  return index;
+}
+
+const uint8_t* point_accumulator::color_pixels(const color_frame& color,
+                                               size_t* stride,
+                                               int* pixel_bytes) {
+  const uint32_t w = color.width, h = color.height;
+  if (!color.data || !w || !h)
+    return nullptr;
+  const pixel_format_traits& traits = format_traits(color.format);
+  const size_t bytes = std::max(1u, traits.bits_per_pixel / 8);
+  const size_t in_stride = color.layout.stride ?
+      color.layout.stride : w * bytes;
+  const uint8_t* origin = color.data + color.layout.y * in_stride +
+      color.layout.x * bytes;
+
+  switch (color.format) {
+    case PIXEL_FORMAT_RGB8:
+      *stride = in_stride;
+      *pixel_bytes = 3;
+      return origin;
+    case PIXEL_FORMAT_Y8:
+    case PIXEL_FORMAT_RAW8:
+      *stride = in_stride;
+      *pixel_bytes = 1;
+      return origin;
+    case PIXEL_FORMAT_Y16:
+      // Gray from the high bytes
+      *stride = w;
+      *pixel_bytes = 1;
+      rgb_.resize(size_t(w) * h);
+      for (uint32_t y = 0; y < h; y++) {
+        const uint16_t* row =
+            reinterpret_cast<const uint16_t*>(origin + y * in_stride);
+        for (uint32_t x = 0; x < w; x++)
+          rgb_[size_t(y) * w + x] = uint8_t(row[x] >> 8);
+      }
+      return rgb_.data();
+    case PIXEL_FORMAT_Z16:
+      if (!colorizer_)
+        colorizer_.reset(new depth_colorizer());
+      rgb_.resize(size_t(w) * h * 3);
+      colorizer_->colorize(rgb_.data(),
+          reinterpret_cast<const uint16_t*>(origin), w, h,
+          int(in_stride / 2));
+      *stride = size_t(w) * 3;
+      *pixel_bytes = 3;
+      return rgb_.data();
+    default:
+      if (!is_yuv_format(color.format))
+        return nullptr;
+      rgb_.resize(size_t(w) * h * 4);
+      convert_yuv_to_rgba(rgb_.data(), origin, w, h, color.format,
+          color.layout.stride);
+      *stride = size_t(w) * 4;
+      *pixel_bytes = 4;
+      return rgb_.data();
+  }
+}
+
+size_t point_accumulator::add(const float* vertices, const float* tex_coords,
+                              size_t count, const color_frame& color,
+                              const extrinsics& pose) {
+  if (!max_blocks_)
+    configure(voxel_size_, kDefaultMaxBytes);
+  frame_++;
+  size_t stride = 0;
+  int pixel_bytes = 0;
+  const uint8_t* pixels = color_pixels(color, &stride, &pixel_bytes);
+
+  samples_.resize(count);
+  const float* r = pose.rotation;
+  const float* t = pose.translation;
+  const double inv_size = 1.0 / voxel_size_;
+  const unsigned bands = unsigned(std::max<size_t>(1, std::min<size_t>(
+      worker_pool::instance().size(), count / kMinBandPoints)));
+  auto band = [&](unsigned b) {
+    const size_t last = count * (b + 1) / bands;
+    for (size_t i = count * b / bands; i < last; i++) {
+      const float* v = vertices + i * 3;
+      sample& s = samples_[i];
+      s.cell = kSkip;
+      if (!v[2])
+        continue;
+      if (pixels) {
+        const float u = tex_coords[i * 2], w = tex_coords[i * 2 + 1];
+        if (!(u >= 0 && u < 1 && w >= 0 && w < 1))
+          continue;
+        const uint8_t* p = pixels + size_t(w * color.height) * stride +
+            size_t(u * color.width) * pixel_bytes;
+        for (int c = 0; c < 3; c++)
+          s.rgb[c] = p[pixel_bytes == 1 ? 0 : c];
+      } else {
+        s.rgb[0] = s.rgb[1] = s.rgb[2] = 255;
+      }
+      // Column-major rotation
+      s.x = r[0] * v[0] + r[3] * v[1] + r[6] * v[2] + t[0];
+      s.y = r[1] * v[0] + r[4] * v[1] + r[7] * v[2] + t[1];
+      s.z = r[2] * v[0] + r[5] * v[1] + r[8] * v[2] + t[2];
+      const int64_t cx = int64_t(std::floor(s.x * inv_size));
+      const int64_t cy = int64_t(std::floor(s.y * inv_size));
+      const int64_t cz = int64_t(std::floor(s.z * inv_size));
+      s.key = block_axis(cx) | block_axis(cy) << kAxisBits |
+          block_axis(cz) << (2 * kAxisBits);
+      s.cell = uint32_t((cx & 3) | (cy & 3) << 2 | (cz & 3) << 4);
+    }
+  };
+  if (bands <= 1)
+    band(0);
+  else
+    worker_pool::instance().run(bands, band);
+
+  uint64_t key = 0;
+  uint32_t index = kNone;
+  for (size_t i = 0; i < count; i++) {
+    const sample& s = samples_[i];
+    if (s.cell == kSkip)
+      continue;
+    if (index == kNone || s.key != key) {
+      key = s.key;
+      index = find_block(key);
+    }
+    block& b = blocks_[index];
+    int8_t& slot = b.cell_voxel[s.cell];
+    if (slot < 0) {
+      slot = int8_t(b.count++);
+      voxels_++;
+      b.voxels[slot] = { s.x, s.y, s.z,
+          float(s.rgb[0]), float(s.rgb[1]), float(s.rgb[2]), 1 };
+    } else {
+      voxel& v = b.voxels[slot];
+      v.weight = std::min(v.weight + 1, kMaxWeight);
+      const float k = 1.f / v.weight;
+      v.x += (s.x - v.x) * k;
+      v.y += (s.y - v.y) * k;
+      v.z += (s.z - v.z) * k;
+      v.r += (s.rgb[0] - v.r) * k;
+      v.g += (s.rgb[1] - v.g) * k;
+      v.b += (s.rgb[2] - v.b) * k;
+    }
+    if (!b.dirty) {
+      b.dirty = true;
+      dirty_.push_back(index);
+    }
+  }
+  return voxels_;
+}
+
+void point_accumulator::upload() {
+  const size_t slot_bytes = kBlockVoxels * kVertexBytes;
+  if (vertices_.size() < blocks_.size() * slot_bytes)
+    vertices_.resize(blocks_.size() * slot_bytes);
+  for (uint32_t index : dirty_) {
+    block& b = blocks_[index];
+    b.dirty = false;
+    uint8_t* out = vertices_.data() + index * slot_bytes;
+    for (uint32_t i = 0; i < b.count; i++, out += kVertexBytes) {
+      const voxel& v = b.voxels[i];
+      const float xyz[3] = { v.x, v.y, v.z };
+      const uint8_t rgba[4] = { uint8_t(v.r + 0.5f), uint8_t(v.g + 0.5f),
+                                uint8_t(v.b + 0.5f), 255 };
+      memcpy(out, xyz, sizeof(xyz));
+      memcpy(out + sizeof(xyz), rgba, sizeof(rgba));
+    }
+  }
+  if (!GLEW_VERSION_1_5) {
+    dirty_.clear();
+    return;
+  }
+
+  if (!vbo_)
+    glGenBuffers(1, &vbo_);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+  if (blocks_.size() > vbo_blocks_) {
+    // Grown buffers start over with everything
+    vbo_blocks_ = std::min(max_blocks_,
+        std::max(blocks_.size(), std::max(vbo_blocks_ * 2,
+                                          kFirstBufferBlocks)));
+    glBufferData(GL_ARRAY_BUFFER, vbo_blocks_ * slot_bytes, nullptr,
+        GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, blocks_.size() * slot_bytes,
+        vertices_.data());
+    uploaded_ += blocks_.size() * slot_bytes;
+  } else {
+    std::sort(dirty_.begin(), dirty_.end());
+    for (size_t i = 0; i < dirty_.size();) {
+      size_t j = i + 1;
+      while (j < dirty_.size() && dirty_[j] == dirty_[j - 1] + 1)
+        j++;
+      const size_t offset = dirty_[i] * slot_bytes;
+      const size_t bytes = (j - i) * slot_bytes;
+      glBufferSubData(GL_ARRAY_BUFFER, offset, bytes,
+          vertices_.data() + offset);
+      uploaded_ += bytes;
+      i = j;
+    }
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  dirty_.clear();
+}
+
+void point_accumulator::draw() {
+  upload();
+  firsts_.clear();
+  counts_.clear();
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    if (!blocks_[i].count)
+      continue;
+    firsts_.push_back(GLint(i * kBlockVoxels));
+    counts_.push_back(GLsizei(blocks_[i].count));
+  }
+  if (firsts_.empty())
+    return;
+
+  const uint8_t* positions = vertices_.data();
+  const uint8_t* colors = positions + 3 * sizeof(float);
+  if (vbo_) {
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    // Offsets into the buffer
+    positions = nullptr;
+    colors = reinterpret_cast<const uint8_t*>(3 * sizeof(float));
+  }
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+  glVertexPointer(3, GL_FLOAT, kVertexBytes, positions);
+  glColorPointer(4, GL_UNSIGNED_BYTE, kVertexBytes, colors);
+  glMultiDrawArrays(GL_POINTS, firsts_.data(), counts_.data(),
+      GLsizei(firsts_.size()));
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  if (vbo_)
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+} // namespace glfw
@@ -0,0 +1,138 @@
+/*
+ * accumulation.h
+ *
+ */
+
+#ifndef ACCUMULATION_H_
+#define ACCUMULATION_H_
+
+#include "camera.h"
+#include "depth_colorizer.h"
+#include "pixel_format.h"
+#include "shader.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace glfw {
+
+// A color frame points take their colors from
+struct color_frame {
+  const uint8_t* data = nullptr;
+  pixel_format format = PIXEL_FORMAT_UNKNOWN;
+  uint32_t width = 0, height = 0;
+  frame_layout layout;
+};
+
+struct accumulation_stats {
+  size_t voxels = 0, blocks = 0;
+  // Bytes the accumulator holds, and may hold at most
+  size_t memory = 0, max_memory = 0;
+  uint64_t evicted_blocks = 0;
+  uint64_t uploaded_bytes = 0;
+};
+
+// Points of many frames merged into one cloud on a voxel grid. Each voxel
+// keeps a running average of the positions and colors that fell into it.
+// Voxels are stored in blocks of 4x4x4 found through a hash of their grid
+// position. Every block owns a fixed slot of the vertex buffer, and only the
+// slots of blocks that changed are uploaded before drawing. Once max_bytes
+// is used up, the blocks least recently added to are evicted to make room.
+// Needs a current context for its whole lifetime.
+class point_accumulator {
+ public:
+  point_accumulator() = default;
+  ~point_accumulator();
+
+  // Voxel edge in meters and the memory cap (host and GPU together); clears.
+  // Until called, voxels are 5 mm and the cap is 256 MB.
+  void configure(float voxel_size, size_t max_bytes);
+  void clear();
+
+  // Merge count points of vertices (x, y, z; points without depth are
+  // skipped) in the camera frame, moved into the common frame by pose,
+  // with colors looked up at tex_coords (u, v) in color (white without
+  // one). Returns the number of voxels.
+  size_t add(const float* vertices, const float* tex_coords, size_t count,
+             const color_frame& color, const extrinsics& pose);
+
+  // Upload the blocks that changed and draw every voxel as a point colored
+  // by its average, with the current transforms
+  void draw();
+
+  float voxel_size() const { return voxel_size_; }
+  accumulation_stats stats() const;
+
+ private:
+  point_accumulator(const point_accumulator&) = delete;
+  point_accumulator& operator=(const point_accumulator&) = delete;
+
+  static const int kBlockVoxels = 64;
+  static const uint32_t kNone = ~0u;
+
+  struct voxel {
+    float x, y, z;
+    float r, g, b;
+    uint32_t weight;
+  };
+
+  struct block {
+    uint64_t key;
+    // Least recently used list, most recent first
+    uint32_t newer, older;
+    uint64_t frame;
+    uint32_t count;
+    bool dirty;
+    // Cell in the block to index into voxels, or -1
+    int8_t cell_voxel[kBlockVoxels];
+    voxel voxels[kBlockVoxels];
+  };
+
+  // A point ready to merge: its block and cell, position and color
+  struct sample {
+    uint64_t key;
+    uint32_t cell;
+    float x, y, z;
+    uint8_t rgb[3];
+  };
+
+  static size_t bytes_per_block();
+  // Pixels of color as RGB, RGBA or gray (pixel_bytes 3, 4 or 1), rows
+  // stride bytes apart; null for frames without colors
+  const uint8_t* color_pixels(const color_frame& color, size_t* stride,
+                              int* pixel_bytes);
+  uint32_t find_block(uint64_t key);
+  void touch(uint32_t index);
+  void unlink(uint32_t index);
+  void upload();
+
+  float voxel_size_ = 0.005f;
+  size_t max_blocks_ = 0;
+  uint64_t frame_ = 0;
+  std::vector<block> blocks_;
+  std::unordered_map<uint64_t, uint32_t> block_of_;
+  uint32_t newest_ = kNone, oldest_ = kNone;
+  std::vector<uint32_t> dirty_;
+  std::vector<sample> samples_;
+  size_t voxels_ = 0;
+  uint64_t evicted_ = 0, uploaded_ = 0;
+
+  // Colors of frames that are not RGB already
+  std::vector<uint8_t> rgb_;
+  std::unique_ptr<depth_colorizer> colorizer_;
+
+  // The vertex buffer's contents (x, y, z, rgba8 per voxel, one slot per
+  // block); the buffer is grown with blocks_
+  std::vector<uint8_t> vertices_;
+  GLuint vbo_ = 0;
+  size_t vbo_blocks_ = 0;
+  std::vector<GLint> firsts_;
+  std::vector<GLsizei> counts_;
+};
+
+} // namespace glfw
+
+#endif /* ACCUMULATION_H_ */
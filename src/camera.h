@@ -0,0 +1,45 @@
+/*
+ * camera.h
+ *
+ */
+
+#ifndef CAMERA_H_
+#define CAMERA_H_
+
+namespace glfw {
+
+// Lens distortion models, numbered as librealsense's rs2_distortion. Others
+// are treated as none.
+enum distortion_model {
+  DISTORTION_NONE = 0,
+  DISTORTION_MODIFIED_BROWN_CONRADY = 1,
+  DISTORTION_INVERSE_BROWN_CONRADY = 2,
+  DISTORTION_BROWN_CONRADY = 4,
+};
+
+// Pinhole model of a stream, as librealsense reports it: principal point
+// and focal lengths in pixels, plus the distortion model and its k1, k2,
+// p1, p2, k3 coefficients
+struct intrinsics {
+  int width = 0, height = 0;
+  float ppx = 0, ppy = 0;
+  float fx = 0, fy = 0;
+  distortion_model model = DISTORTION_NONE;
+  float coeffs[5] = { 0, 0, 0, 0, 0 };
+
+  bool distorted() const {
+    return model != DISTORTION_NONE &&
+        (coeffs[0] || coeffs[1] || coeffs[2] || coeffs[3] || coeffs[4]);
+  }
+};
+
+// Rigid transform from one stream's space to another's. rotation is column
+// major: to = rotation * from + translation.
+struct extrinsics {
+  float rotation[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+  float translation[3] = { 0, 0, 0 };
+};
+
+} // namespace glfw
+
+#endif /* CAMERA_H_ */
@@ -0,0 +1,123 @@
+/*
+ * colormap.cc
+ *
+ */
+
+#include "colormap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace glfw {
+
+namespace {
+
+inline uint32_t pack_rgb(int r, int g, int b) {
+  return uint32_t(r) | (uint32_t(g) << 8) | (uint32_t(b) << 16);
+}
+
+// Evenly spaced control points, t = 0, 0.1, .., 1 (matplotlib samples)
+const uint8_t kInferno[11][3] = {
+  {0, 0, 4}, {22, 11, 57}, {66, 10, 104}, {106, 23, 110}, {147, 38, 103},
+  {188, 55, 84}, {221, 81, 58}, {243, 120, 25}, {252, 165, 10},
+  {246, 215, 70}, {252, 255, 164},
+};
+
+const uint8_t kViridis[11][3] = {
+  {68, 1, 84}, {72, 36, 117}, {65, 68, 135}, {53, 95, 141}, {42, 120, 142},
+  {33, 145, 140}, {34, 168, 132}, {68, 191, 112}, {122, 209, 81},
+  {189, 223, 38}, {253, 231, 37},
+};
+
+void interpolate(uint32_t* palette, const uint8_t (*stops)[3], int count) {
+  for (int i = 0; i < 256; ++i) {
+    const float t = i / 255.f * (count - 1);
+    const int s = std::min(int(t), count - 2);
+    const float w = t - s;
+    int c[3];
+    for (int k = 0; k < 3; ++k)
+      c[k] = int(std::lround(stops[s][k] * (1 - w) + stops[s + 1][k] * w));
+    palette[i] = pack_rgb(c[0], c[1], c[2]);
+  }
+}
+
+inline int jet_channel(float t, float center) {
+  float v = 1.5f - std::fabs(4 * t - center);
+  return int(std::lround(255 * std::min(1.f, std::max(0.f, v))));
+}
+
+void build_palette(colormap_id id, uint32_t* palette) {
+  switch (id) {
+    case COLORMAP_JET:
+      for (int i = 0; i < 256; ++i) {
+        const float t = i / 255.f;
+        palette[i] = pack_rgb(jet_channel(t, 3), jet_channel(t, 2),
+                              jet_channel(t, 1));
+      }
+      break;
+    case COLORMAP_INFERNO:
+      interpolate(palette, kInferno, 11);
+      break;
+    case COLORMAP_VIRIDIS:
+      interpolate(palette, kViridis, 11);
+      break;
+    case COLORMAP_GRAYSCALE:
+      for (int i = 0; i < 256; ++i) palette[i] = pack_rgb(i, i, i);
+      break;
+    case COLORMAP_RAMP:
+    default:
+      for (int i = 0; i < 256; ++i) palette[i] = pack_rgb(255 - i, 0, i);
+      break;
+  }
+}
+
+std::shared_ptr<const colormap>& default_colormap_slot() {
+  static std::shared_ptr<const colormap> map =
+      std::make_shared<colormap>(COLORMAP_RAMP);
+  return map;
+}
+
+} // namespace
+
+colormap::colormap(colormap_id id, uint16_t near_depth, uint16_t far_depth)
+    : id_(id), near_(near_depth), far_(far_depth) {
+  build_palette(id, palette_);
+  if (!fixed_range()) return;
+
+  // f = (d - near) * 255 / (far - near), clamped to the ends of the palette
+  lut_.resize(0x10000);
+  const uint32_t span = far_ - near_;
+  lut_[0] = kNoDepthColor;
+  std::fill(lut_.begin() + 1, lut_.begin() + near_ + 1, palette_[0]);
+  for (uint32_t d = near_ + 1u; d < far_; ++d)
+    lut_[d] = palette_[(d - near_) * 255 / span];
+  std::fill(lut_.begin() + far_, lut_.end(), palette_[255]);
+}
+
+bool colormap_from_name(const char* name, colormap_id* id) {
+  static const struct { const char* name; colormap_id id; } names[] = {
+    { "ramp", COLORMAP_RAMP },
+    { "jet", COLORMAP_JET },
+    { "inferno", COLORMAP_INFERNO },
+    { "viridis", COLORMAP_VIRIDIS },
+    { "grayscale", COLORMAP_GRAYSCALE },
+  };
+  for (const auto& n : names) {
+    if (!strcmp(n.name, name)) {
+      *id = n.id;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::shared_ptr<const colormap> default_colormap() {
+  return default_colormap_slot();
+}
+
+void set_default_colormap(std::shared_ptr<const colormap> map) {
+  default_colormap_slot() = map;
+}
+
+} // namespace glfw
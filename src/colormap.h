@@ -0,0 +1,60 @@
+/*
+ * colormap.h
+ *
+ */
+
+#ifndef COLORMAP_H_
+#define COLORMAP_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace glfw {
+
+enum colormap_id {
+  COLORMAP_RAMP,       // the original red to blue ramp
+  COLORMAP_JET,
+  COLORMAP_INFERNO,
+  COLORMAP_VIRIDIS,
+  COLORMAP_GRAYSCALE,
+};
+
+// Colors are packed as 0x00BBGGRR so that the bytes read R, G, B, 0.
+const uint32_t kNoDepthColor = 20 | (5 << 8) | (0 << 16);
+
+// An immutable depth colormap: a 256-entry palette and, in fixed range mode,
+// a 64K-entry depth to color table baked once at construction.
+class colormap {
+ public:
+  // near < far selects fixed range mode over [near, far] in depth units,
+  // otherwise the palette is driven by histogram equalization.
+  explicit colormap(colormap_id id, uint16_t near_depth = 0,
+                    uint16_t far_depth = 0);
+
+  colormap_id id() const { return id_; }
+  bool fixed_range() const { return near_ < far_; }
+  uint16_t near_depth() const { return near_; }
+  uint16_t far_depth() const { return far_; }
+
+  const uint32_t* palette() const { return palette_; }
+  const uint32_t* lut() const { return lut_.data(); }  // fixed range only
+
+ private:
+  colormap_id id_;
+  uint16_t near_, far_;
+  uint32_t palette_[256];
+  std::vector<uint32_t> lut_;
+};
+
+// Name ("ramp", "jet", "inferno", "viridis", "grayscale") to id; false if
+// the name is unknown.
+bool colormap_from_name(const char* name, colormap_id* id);
+
+// Colormap used by colorizers that were not given their own.
+std::shared_ptr<const colormap> default_colormap();
+void set_default_colormap(std::shared_ptr<const colormap> map);
+
+} // namespace glfw
+
+#endif /* COLORMAP_H_ */
@@ -0,0 +1,199 @@
+/*
+ * decimation.cc
+ *
+ * Voxels are found with a hash set of their grid coordinates. Points come
+ * in image order, where neighbours mostly share a voxel, so a point is only
+ * looked up when its voxel differs from the one before. Keys are computed in
+ * bands across the worker pool; the set is split by hash so that each worker
+ * owns a share of the voxels (and a smaller table) but still visits the
+ * points in order, keeping the result independent of the number of workers.
+ */
+
+#include "decimation.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+
+namespace glfw {
+
+namespace {
+
+float voxel_setting = 0;
+size_t budget_setting = 0;
+
+// Grid coordinates are biased into 21 bits each and packed into 63
+const int kAxisBits = 21;
+const double kAxisBias = double(1 << (kAxisBits - 1));
+const int64_t kAxisMax = (int64_t(1) << kAxisBits) - 1;
+const uint64_t kNoVoxel = ~uint64_t(0);
+
+// Fewer points than this per worker are not worth splitting
+const size_t kMinPartPoints = 0x10000;
+const size_t kMinSlots = 1024;
+
+// Below the budget by this factor, the grid is refined again
+const float kRefineBelow = 0.5f;
+// Starting voxel size when only a budget is set (meters)
+const float kFirstAdaptiveSize = 0.002f;
+
+// Truncating after the bias floors for every coordinate in range
+inline uint64_t axis(float v, double inv_size) {
+  const double cell = v * inv_size + kAxisBias;
+  if (!(cell > 0))
+    return 0;
+  return uint64_t(std::min(int64_t(cell), kAxisMax));
+}
+
+inline uint64_t voxel_key(const float* p, double inv_size) {
+  return axis(p[0], inv_size) | axis(p[1], inv_size) << kAxisBits |
+      axis(p[2], inv_size) << (2 * kAxisBits);
+}
+
+inline uint64_t hash(uint64_t key) {
+  return (key * 0x9E3779B97F4A7C15ull) >> 32;
+}
+
+// Which of parts owns a hash; uses the bits above those picking slots
+inline unsigned part_of(uint64_t hash, unsigned parts) {
+  return unsigned((hash & 0xFFFFFFFFu) * parts >> 32);
+}
+
+// Keep every (count / budget)-th point, in order
+size_t thin(float* points, size_t count, int floats, size_t budget) {
+  for (size_t j = 0; j < budget; j++) {
+    const size_t i = size_t(double(j) * count / budget);
+    if (i != j)
+      memmove(points + j * floats, points + i * floats,
+          floats * sizeof(float));
+  }
+  return budget;
+}
+
+} // namespace
+
+void set_point_decimation(float voxel_size, size_t budget) {
+  voxel_setting = std::max(voxel_size, 0.f);
+  budget_setting = budget;
+}
+
+float point_decimation_voxel_size() {
+  return voxel_setting;
+}
+
+size_t point_decimation_budget() {
+  return budget_setting;
+}
+
+bool point_decimation_enabled() {
+  return voxel_setting > 0 || budget_setting > 0;
+}
+
+void point_decimator::voxel_set::reset() {
+  size_t n = kMinSlots;
+  while (n < used * 4)
+    n *= 2;
+  slots.assign(n, kNoVoxel);
+  used = 0;
+}
+
+bool point_decimator::voxel_set::insert(uint64_t key, uint64_t hash) {
+  const size_t mask = slots.size() - 1;
+  size_t slot = size_t(hash) & mask;
+  while (slots[slot] != kNoVoxel) {
+    if (slots[slot] == key)
+      return false;
+    slot = (slot + 1) & mask;
+  }
+  slots[slot] = key;
+  // At most half full
+  if (++used * 2 > slots.size())
+    grow();
+  return true;
+}
+
+void point_decimator::voxel_set::grow() {
+  std::vector<uint64_t> old(slots.size() * 2, kNoVoxel);
+  old.swap(slots);
+  const size_t mask = slots.size() - 1;
+  for (uint64_t key : old) {
+    if (key == kNoVoxel)
+      continue;
+    size_t slot = size_t(hash(key)) & mask;
+    while (slots[slot] != kNoVoxel)
+      slot = (slot + 1) & mask;
+    slots[slot] = key;
+  }
+}
+
+size_t point_decimator::voxelize(float* points, size_t count, int floats,
+                                 float size) {
+  const unsigned parts = unsigned(std::max<size_t>(1, std::min<size_t>(
+      worker_pool::instance().size(), count / kMinPartPoints)));
+  auto run = [parts](const std::function<void(unsigned)>& fn) {
+    if (parts <= 1)
+      fn(0);
+    else
+      worker_pool::instance().run(parts, fn);
+  };
+
+  const double inv_size = 1.0 / size;
+  keys_.resize(count);
+  run([&](unsigned part) {
+    const size_t last = count * (part + 1) / parts;
+    for (size_t i = count * part / parts; i < last; i++)
+      keys_[i] = voxel_key(points + i * floats, inv_size);
+  });
+
+  first_.assign(count, 0);
+  sets_.resize(parts);
+  run([&](unsigned part) {
+    voxel_set& set = sets_[part];
+    set.reset();
+    for (size_t i = 0; i < count; i++) {
+      const uint64_t key = keys_[i];
+      if (i && key == keys_[i - 1])
+        continue;
+      const uint64_t h = hash(key);
+      if (part_of(h, parts) == part && set.insert(key, h))
+        first_[i] = 1;
+    }
+  });
+
+  size_t kept = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (!first_[i])
+      continue;
+    if (kept != i)
+      memmove(points + kept * floats, points + i * floats,
+          floats * sizeof(float));
+    kept++;
+  }
+  return kept;
+}
+
+size_t point_decimator::apply(float* points, size_t count, int floats) {
+  const size_t budget = budget_setting;
+  if (!budget || !size_ || size_ < voxel_setting)
+    size_ = voxel_setting;
+
+  size_t kept = size_ > 0 ? voxelize(points, count, floats, size_) : count;
+  if (!budget)
+    return kept;
+
+  // Points on surfaces go with the inverse square of the voxel size
+  if (kept > budget) {
+    const float grow = std::sqrt(float(kept) / budget);
+    size_ = std::max(size_ ? size_ * grow : kFirstAdaptiveSize,
+        voxel_setting);
+    kept = thin(points, kept, floats, budget);
+  } else if (size_ > voxel_setting && kept < budget * kRefineBelow) {
+    size_ = std::max(size_ * std::sqrt(float(kept) / (budget * kRefineBelow)),
+        voxel_setting);
+  }
+  return kept;
+}
+
+} // namespace glfw
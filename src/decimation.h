@@ -0,0 +1,61 @@
+/*
+ * decimation.h
+ *
+ */
+
+#ifndef DECIMATION_H_
+#define DECIMATION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace glfw {
+
+// Thin point clouds before they are uploaded: keep one point per cube of
+// voxel_size meters (0 for no grid), and at most budget points (0 for no
+// limit). Applies to every point cloud drawn from the CPU.
+void set_point_decimation(float voxel_size, size_t budget);
+float point_decimation_voxel_size();
+size_t point_decimation_budget();
+bool point_decimation_enabled();
+
+// Decimation state of one point cloud. Over budget, the grid of the next
+// frames is coarsened until the budget holds without thinning, and refined
+// again (down to the configured voxel size) once well below it.
+class point_decimator {
+ public:
+  // Decimate count points of floats floats each (x, y, z first) in place;
+  // returns how many are left. The first point into each voxel stands for
+  // it, with its own texture coordinate and so its color.
+  size_t apply(float* points, size_t count, int floats);
+
+  // Voxel size used for the last frame
+  float voxel_size() const { return size_; }
+
+ private:
+  // Open addressing set of voxel keys
+  struct voxel_set {
+    std::vector<uint64_t> slots;
+    size_t used = 0;
+
+    // Empty the set, sized for about as many keys as it held before
+    void reset();
+    // Whether key was new
+    bool insert(uint64_t key, uint64_t hash);
+    void grow();
+  };
+
+  size_t voxelize(float* points, size_t count, int floats, float size);
+
+  float size_ = 0;
+  // Voxel of each point, and whether it is the first point in it
+  std::vector<uint64_t> keys_;
+  std::vector<uint8_t> first_;
+  // One set per worker, each for its share of the voxels
+  std::vector<voxel_set> sets_;
+};
+
+} // namespace glfw
+
+#endif /* DECIMATION_H_ */
@@ -0,0 +1,487 @@
+/*
+ * deproject.cc
+ *
+ * Undistortion only depends on the pixel, so it is done once per set of
+ * depth intrinsics into a table of rays (x / z, y / z per pixel), as
+ * librealsense's pointcloud does. Per frame, blocks of pixels are scaled
+ * along their rays, moved into color space and projected, with AVX2 and
+ * NEON versions picked once at runtime that compute the same values as the
+ * scalar fallback (NEON may fuse multiply-adds). Rows are split into bands
+ * on the worker pool.
+ */
+
+#include "deproject.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define DEPROJECT_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define DEPROJECT_TARGET(isa)
+#else
+#define DEPROJECT_TARGET(isa) __attribute__((target(isa)))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define DEPROJECT_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace glfw {
+
+namespace {
+
+const size_t kMinBandPixels = 0x10000;
+
+// Pixels per kernel call; the results go to one array per component
+const size_t kBlock = 64;
+enum { X, Y, Z, U, V, kComponents };
+
+// librealsense iterates its Brown-Conrady undistortion this often
+const int kUndistortIterations = 10;
+
+enum distortion { DISTORT_NONE, DISTORT_BROWN_CONRADY, DISTORT_MODIFIED };
+
+// Per frame constants of the kernels
+struct projection {
+  float scale;
+  float r[9], t[3];
+  float fx, fy, ppx, ppy;
+  float inv_width, inv_height;
+  // k1, k2, k3 and 2 * p1, 2 * p2, p1, p2
+  float k1, k2, k3, two_p1, two_p2, p1, p2;
+  distortion distort;
+};
+
+struct ray_table {
+  intrinsics intrin;
+  std::vector<float> x, y;
+};
+
+bool same_intrinsics(const intrinsics& a, const intrinsics& b) {
+  if (a.width != b.width || a.height != b.height || a.ppx != b.ppx ||
+      a.ppy != b.ppy || a.fx != b.fx || a.fy != b.fy || a.model != b.model)
+    return false;
+  return std::equal(a.coeffs, a.coeffs + 5, b.coeffs);
+}
+
+// rs2_deproject_pixel_to_point() for z = 1
+void undistort(const intrinsics& in, int px, int py, double* rx, double* ry) {
+  double x = (px - in.ppx) / in.fx, y = (py - in.ppy) / in.fy;
+  const double* c = nullptr;
+  double coeffs[5];
+  if (in.distorted()) {
+    std::copy(in.coeffs, in.coeffs + 5, coeffs);
+    c = coeffs;
+  }
+  if (c && in.model == DISTORTION_INVERSE_BROWN_CONRADY) {
+    const double r2 = x * x + y * y;
+    const double f = 1 + c[0] * r2 + c[1] * r2 * r2 + c[4] * r2 * r2 * r2;
+    const double ux = x * f + 2 * c[2] * x * y + c[3] * (r2 + 2 * x * x);
+    const double uy = y * f + 2 * c[3] * x * y + c[2] * (r2 + 2 * y * y);
+    x = ux;
+    y = uy;
+  } else if (c && in.model == DISTORTION_BROWN_CONRADY) {
+    const double xo = x, yo = y;
+    for (int i = 0; i < kUndistortIterations; i++) {
+      const double r2 = x * x + y * y;
+      const double icdist = 1 / (1 + ((c[4] * r2 + c[1]) * r2 + c[0]) * r2);
+      const double xq = x / icdist, yq = y / icdist;
+      const double dx = 2 * c[2] * xq * yq + c[3] * (r2 + 2 * xq * xq);
+      const double dy = 2 * c[3] * xq * yq + c[2] * (r2 + 2 * yq * yq);
+      x = (xo - dx) * icdist;
+      y = (yo - dy) * icdist;
+    }
+  }
+  *rx = x;
+  *ry = y;
+}
+
+const ray_table& rays_for(const intrinsics& in) {
+  static ray_table table;
+  if (table.x.empty() || !same_intrinsics(table.intrin, in)) {
+    table.intrin = in;
+    table.x.resize(size_t(in.width) * in.height);
+    table.y.resize(size_t(in.width) * in.height);
+    for (int py = 0; py < in.height; py++) {
+      for (int px = 0; px < in.width; px++) {
+        double x, y;
+        undistort(in, px, py, &x, &y);
+        table.x[size_t(py) * in.width + px] = float(x);
+        table.y[size_t(py) * in.width + px] = float(y);
+      }
+    }
+  }
+  return table;
+}
+
+projection make_projection(const deprojection& d) {
+  projection p;
+  p.scale = d.depth_scale;
+  std::copy(d.depth_to_color.rotation, d.depth_to_color.rotation + 9, p.r);
+  std::copy(d.depth_to_color.translation,
+      d.depth_to_color.translation + 3, p.t);
+  p.fx = d.color.fx;
+  p.fy = d.color.fy;
+  p.ppx = d.color.ppx;
+  p.ppy = d.color.ppy;
+  p.inv_width = 1.f / d.color.width;
+  p.inv_height = 1.f / d.color.height;
+  p.k1 = d.color.coeffs[0];
+  p.k2 = d.color.coeffs[1];
+  p.k3 = d.color.coeffs[4];
+  p.p1 = d.color.coeffs[2];
+  p.p2 = d.color.coeffs[3];
+  p.two_p1 = 2 * p.p1;
+  p.two_p2 = 2 * p.p2;
+  p.distort = DISTORT_NONE;
+  // rs2_project_point_to_pixel() projects with the modified model for the
+  // inverse one too, which color streams mostly report
+  if (d.color.distorted()) {
+    if (d.color.model == DISTORTION_BROWN_CONRADY)
+      p.distort = DISTORT_BROWN_CONRADY;
+    else if (d.color.model == DISTORTION_MODIFIED_BROWN_CONRADY ||
+             d.color.model == DISTORTION_INVERSE_BROWN_CONRADY)
+      p.distort = DISTORT_MODIFIED;
+  }
+  return p;
+}
+
+typedef void (*block_kernel)(float* out, const uint16_t* depth,
+                             const float* ray_x, const float* ray_y,
+                             size_t n, const projection& p);
+
+// Points and texture coordinates of n <= kBlock pixels into the component
+// arrays of out. The vector kernels evaluate exactly these expressions.
+void block_scalar(float* out, const uint16_t* depth, const float* ray_x,
+                  const float* ray_y, size_t n, const projection& p) {
+  for (size_t i = 0; i < n; i++) {
+    const float z = float(depth[i]) * p.scale;
+    const float x = ray_x[i] * z, y = ray_y[i] * z;
+    const float cx = p.r[0] * x + p.r[3] * y + p.r[6] * z + p.t[0];
+    const float cy = p.r[1] * x + p.r[4] * y + p.r[7] * z + p.t[1];
+    const float cz = p.r[2] * x + p.r[5] * y + p.r[8] * z + p.t[2];
+    float a = cx / cz, b = cy / cz;
+    if (p.distort != DISTORT_NONE) {
+      const float r2 = a * a + b * b;
+      const float f = 1.f + r2 * (p.k1 + r2 * (p.k2 + r2 * p.k3));
+      const float xf = a * f, yf = b * f;
+      // The modified model applies the tangential terms after the radial
+      const float ta = p.distort == DISTORT_MODIFIED ? xf : a;
+      const float tb = p.distort == DISTORT_MODIFIED ? yf : b;
+      const float ab = ta * tb;
+      a = xf + p.two_p1 * ab + p.p2 * (r2 + 2.f * (ta * ta));
+      b = yf + p.two_p2 * ab + p.p1 * (r2 + 2.f * (tb * tb));
+    }
+    const bool hole = !depth[i];
+    out[X * kBlock + i] = hole ? 0.f : x;
+    out[Y * kBlock + i] = hole ? 0.f : y;
+    out[Z * kBlock + i] = z;
+    out[U * kBlock + i] = hole ? 0.f : (a * p.fx + p.ppx) * p.inv_width;
+    out[V * kBlock + i] = hole ? 0.f : (b * p.fy + p.ppy) * p.inv_height;
+  }
+}
+
+#ifdef DEPROJECT_X86
+
+bool cpu_has_avx2() {
+#ifdef _MSC_VER
+  int regs[4];
+  __cpuid(regs, 1);
+  bool osxsave = (regs[2] & (1 << 27)) != 0;
+  if (!osxsave || (_xgetbv(0) & 6) != 6) return false;
+  __cpuidex(regs, 7, 0);
+  return (regs[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+// Row of the rotation starting at r (column major), plus t
+DEPROJECT_TARGET("avx2")
+inline __m256 transform_avx2(const __m256* r, __m256 t,
+                             __m256 x, __m256 y, __m256 z) {
+  return _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+      _mm256_mul_ps(r[0], x), _mm256_mul_ps(r[3], y)),
+      _mm256_mul_ps(r[6], z)), t);
+}
+
+DEPROJECT_TARGET("avx2")
+void block_avx2(float* out, const uint16_t* depth, const float* ray_x,
+                const float* ray_y, size_t n, const projection& p) {
+  const __m256 scale = _mm256_set1_ps(p.scale);
+  __m256 r[9], t[3];
+  for (int k = 0; k < 9; k++) r[k] = _mm256_set1_ps(p.r[k]);
+  for (int k = 0; k < 3; k++) t[k] = _mm256_set1_ps(p.t[k]);
+  const __m256 fx = _mm256_set1_ps(p.fx), fy = _mm256_set1_ps(p.fy);
+  const __m256 ppx = _mm256_set1_ps(p.ppx), ppy = _mm256_set1_ps(p.ppy);
+  const __m256 inv_w = _mm256_set1_ps(p.inv_width);
+  const __m256 inv_h = _mm256_set1_ps(p.inv_height);
+  const __m256 one = _mm256_set1_ps(1.f), two = _mm256_set1_ps(2.f);
+  const __m256 k1 = _mm256_set1_ps(p.k1), k2 = _mm256_set1_ps(p.k2);
+  const __m256 k3 = _mm256_set1_ps(p.k3);
+  const __m256 p1 = _mm256_set1_ps(p.p1), p2 = _mm256_set1_ps(p.p2);
+  const __m256 two_p1 = _mm256_set1_ps(p.two_p1);
+  const __m256 two_p2 = _mm256_set1_ps(p.two_p2);
+
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i d = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(depth + i)));
+    const __m256 z = _mm256_mul_ps(_mm256_cvtepi32_ps(d), scale);
+    const __m256 x = _mm256_mul_ps(_mm256_loadu_ps(ray_x + i), z);
+    const __m256 y = _mm256_mul_ps(_mm256_loadu_ps(ray_y + i), z);
+    const __m256 cz = transform_avx2(r + 2, t[2], x, y, z);
+    __m256 a = _mm256_div_ps(transform_avx2(r, t[0], x, y, z), cz);
+    __m256 b = _mm256_div_ps(transform_avx2(r + 1, t[1], x, y, z), cz);
+    if (p.distort != DISTORT_NONE) {
+      const __m256 r2 = _mm256_add_ps(_mm256_mul_ps(a, a), _mm256_mul_ps(b, b));
+      const __m256 f = _mm256_add_ps(one, _mm256_mul_ps(r2, _mm256_add_ps(k1,
+          _mm256_mul_ps(r2, _mm256_add_ps(k2, _mm256_mul_ps(r2, k3))))));
+      const __m256 xf = _mm256_mul_ps(a, f), yf = _mm256_mul_ps(b, f);
+      const __m256 ta = p.distort == DISTORT_MODIFIED ? xf : a;
+      const __m256 tb = p.distort == DISTORT_MODIFIED ? yf : b;
+      const __m256 ab = _mm256_mul_ps(ta, tb);
+      a = _mm256_add_ps(_mm256_add_ps(xf, _mm256_mul_ps(two_p1, ab)),
+          _mm256_mul_ps(p2, _mm256_add_ps(r2,
+              _mm256_mul_ps(two, _mm256_mul_ps(ta, ta)))));
+      b = _mm256_add_ps(_mm256_add_ps(yf, _mm256_mul_ps(two_p2, ab)),
+          _mm256_mul_ps(p1, _mm256_add_ps(r2,
+              _mm256_mul_ps(two, _mm256_mul_ps(tb, tb)))));
+    }
+    const __m256 u = _mm256_mul_ps(
+        _mm256_add_ps(_mm256_mul_ps(a, fx), ppx), inv_w);
+    const __m256 v = _mm256_mul_ps(
+        _mm256_add_ps(_mm256_mul_ps(b, fy), ppy), inv_h);
+    const __m256 hole = _mm256_castsi256_ps(
+        _mm256_cmpeq_epi32(d, _mm256_setzero_si256()));
+    _mm256_storeu_ps(out + X * kBlock + i, _mm256_andnot_ps(hole, x));
+    _mm256_storeu_ps(out + Y * kBlock + i, _mm256_andnot_ps(hole, y));
+    _mm256_storeu_ps(out + Z * kBlock + i, z);
+    _mm256_storeu_ps(out + U * kBlock + i, _mm256_andnot_ps(hole, u));
+    _mm256_storeu_ps(out + V * kBlock + i, _mm256_andnot_ps(hole, v));
+  }
+  if (i < n) {
+    float tail[kComponents * kBlock];
+    block_scalar(tail, depth + i, ray_x + i, ray_y + i, n - i, p);
+    for (int c = 0; c < kComponents; c++)
+      std::copy(tail + c * kBlock, tail + c * kBlock + (n - i),
+          out + c * kBlock + i);
+  }
+}
+
+#endif // DEPROJECT_X86
+
+#ifdef DEPROJECT_NEON
+
+void block_neon(float* out, const uint16_t* depth, const float* ray_x,
+                const float* ray_y, size_t n, const projection& p) {
+  const float32x4_t one = vdupq_n_f32(1.f), two = vdupq_n_f32(2.f);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const uint32x4_t d = vmovl_u16(vld1_u16(depth + i));
+    const float32x4_t z = vmulq_n_f32(vcvtq_f32_u32(d), p.scale);
+    const float32x4_t x = vmulq_f32(vld1q_f32(ray_x + i), z);
+    const float32x4_t y = vmulq_f32(vld1q_f32(ray_y + i), z);
+    auto row = [&](int k) {
+      return vaddq_f32(vaddq_f32(vaddq_f32(vmulq_n_f32(x, p.r[k]),
+          vmulq_n_f32(y, p.r[k + 3])), vmulq_n_f32(z, p.r[k + 6])),
+          vdupq_n_f32(p.t[k]));
+    };
+    const float32x4_t cz = row(2);
+    float32x4_t a = vdivq_f32(row(0), cz), b = vdivq_f32(row(1), cz);
+    if (p.distort != DISTORT_NONE) {
+      const float32x4_t r2 = vaddq_f32(vmulq_f32(a, a), vmulq_f32(b, b));
+      const float32x4_t f = vaddq_f32(one, vmulq_f32(r2,
+          vaddq_f32(vdupq_n_f32(p.k1), vmulq_f32(r2,
+          vaddq_f32(vdupq_n_f32(p.k2), vmulq_n_f32(r2, p.k3))))));
+      const float32x4_t xf = vmulq_f32(a, f), yf = vmulq_f32(b, f);
+      const float32x4_t ta = p.distort == DISTORT_MODIFIED ? xf : a;
+      const float32x4_t tb = p.distort == DISTORT_MODIFIED ? yf : b;
+      const float32x4_t ab = vmulq_f32(ta, tb);
+      a = vaddq_f32(vaddq_f32(xf, vmulq_n_f32(ab, p.two_p1)), vmulq_n_f32(
+          vaddq_f32(r2, vmulq_f32(two, vmulq_f32(ta, ta))), p.p2));
+      b = vaddq_f32(vaddq_f32(yf, vmulq_n_f32(ab, p.two_p2)), vmulq_n_f32(
+          vaddq_f32(r2, vmulq_f32(two, vmulq_f32(tb, tb))), p.p1));
+    }
+    const float32x4_t u = vmulq_n_f32(vaddq_f32(vmulq_n_f32(a, p.fx),
+        vdupq_n_f32(p.ppx)), p.inv_width);
+    const float32x4_t v = vmulq_n_f32(vaddq_f32(vmulq_n_f32(b, p.fy),
+        vdupq_n_f32(p.ppy)), p.inv_height);
+    const uint32x4_t valid = vtstq_u32(d, d);
+    auto masked = [&](float32x4_t c) {
+      return vreinterpretq_f32_u32(
+          vandq_u32(vreinterpretq_u32_f32(c), valid));
+    };
+    vst1q_f32(out + X * kBlock + i, masked(x));
+    vst1q_f32(out + Y * kBlock + i, masked(y));
+    vst1q_f32(out + Z * kBlock + i, z);
+    vst1q_f32(out + U * kBlock + i, masked(u));
+    vst1q_f32(out + V * kBlock + i, masked(v));
+  }
+  if (i < n) {
+    float tail[kComponents * kBlock];
+    block_scalar(tail, depth + i, ray_x + i, ray_y + i, n - i, p);
+    for (int c = 0; c < kComponents; c++)
+      std::copy(tail + c * kBlock, tail + c * kBlock + (n - i),
+          out + c * kBlock + i);
+  }
+}
+
+#endif // DEPROJECT_NEON
+
+struct deproject_kernels {
+  const char* name;
+  block_kernel block;
+};
+
+deproject_kernels select_kernels() {
+#ifdef DEPROJECT_X86
+  if (cpu_has_avx2()) return { "avx2", block_avx2 };
+#endif
+#ifdef DEPROJECT_NEON
+  return { "neon", block_neon };
+#endif
+  return { "scalar", block_scalar };
+}
+
+const deproject_kernels& kernels() {
+  static const deproject_kernels k = select_kernels();
+  return k;
+}
+
+unsigned band_count(const intrinsics& in) {
+  return unsigned(std::max<size_t>(1, std::min<size_t>(
+      std::min<size_t>(worker_pool::instance().size(), in.height),
+      size_t(in.width) * in.height / kMinBandPixels)));
+}
+
+// Call fn(band, first row, last row) for bands of rows across the pool
+template <typename Fn>
+void for_bands(unsigned bands, int height, Fn fn) {
+  auto run = [&](unsigned b) {
+    fn(b, int(size_t(height) * b / bands),
+        int(size_t(height) * (b + 1) / bands));
+  };
+  if (bands <= 1)
+    run(0);
+  else
+    worker_pool::instance().run(bands, run);
+}
+
+// Call fn(block, its depths, pixel index, n) for each block of rows
+// [first, last)
+template <typename Fn>
+void for_blocks(const uint16_t* depth, int stride, const ray_table& rays,
+                const projection& p, int first, int last, Fn fn) {
+  const int width = rays.intrin.width;
+  const block_kernel block = kernels().block;
+  float soa[kComponents * kBlock];
+  for (int row = first; row < last; row++) {
+    for (int x = 0; x < width; x += int(kBlock)) {
+      const size_t n = std::min<size_t>(kBlock, size_t(width - x));
+      const size_t at = size_t(row) * width + x;
+      block(soa, depth + size_t(row) * stride + x, rays.x.data() + at,
+          rays.y.data() + at, n, p);
+      fn(soa, depth + size_t(row) * stride + x, at, n);
+    }
+  }
+}
+
+size_t count_depths(const uint16_t* depth, int width, int stride,
+                    int first, int last) {
+  size_t n = 0;
+  for (int row = first; row < last; row++) {
+    const uint16_t* d = depth + size_t(row) * stride;
+    for (int x = 0; x < width; x++)
+      n += d[x] != 0;
+  }
+  return n;
+}
+
+} // namespace
+
+size_t deproject_depth(float* vertices, float* tex_coords,
+                       const uint16_t* depth, int stride,
+                       const deprojection& d) {
+  const ray_table& rays = rays_for(d.depth);
+  const projection p = make_projection(d);
+  if (!stride)
+    stride = d.depth.width;
+  const unsigned bands = band_count(d.depth);
+  std::vector<size_t> counts(bands, 0);
+  for_bands(bands, d.depth.height, [&](unsigned b, int first, int last) {
+    size_t valid = 0;
+    for_blocks(depth, stride, rays, p, first, last,
+        [&](const float* soa, const uint16_t* d, size_t at, size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        float* v = vertices + (at + i) * 3;
+        float* t = tex_coords + (at + i) * 2;
+        v[0] = soa[X * kBlock + i];
+        v[1] = soa[Y * kBlock + i];
+        v[2] = soa[Z * kBlock + i];
+        t[0] = soa[U * kBlock + i];
+        t[1] = soa[V * kBlock + i];
+        valid += d[i] != 0;
+      }
+    });
+    counts[b] = valid;
+  });
+  size_t total = 0;
+  for (size_t c : counts)
+    total += c;
+  return total;
+}
+
+size_t deproject_points(float* out, const uint16_t* depth, int stride,
+                        const deprojection& d) {
+  const ray_table& rays = rays_for(d.depth);
+  const projection p = make_projection(d);
+  if (!stride)
+    stride = d.depth.width;
+  const unsigned bands = band_count(d.depth);
+
+  // Each band writes its points after those of the bands before it
+  std::vector<size_t> offsets(bands + 1, 0);
+  for_bands(bands, d.depth.height, [&](unsigned b, int first, int last) {
+    offsets[b + 1] = count_depths(depth, d.depth.width, stride, first, last);
+  });
+  for (unsigned b = 0; b < bands; b++)
+    offsets[b + 1] += offsets[b];
+
+  for_bands(bands, d.depth.height, [&](unsigned b, int first, int last) {
+    float* band_out = out + offsets[b] * 5;
+    size_t written = 0;
+    for_blocks(depth, stride, rays, p, first, last,
+        [&](const float* soa, const uint16_t* d, size_t, size_t n) {
+      // Indices of the points with a depth, gathered without branching
+      unsigned keep[kBlock];
+      size_t m = 0;
+      for (size_t i = 0; i < n; i++) {
+        keep[m] = unsigned(i);
+        m += d[i] != 0;
+      }
+      for (size_t j = 0; j < m; j++) {
+        const unsigned i = keep[j];
+        float* o = band_out + (written + j) * 5;
+        o[0] = soa[X * kBlock + i];
+        o[1] = soa[Y * kBlock + i];
+        o[2] = soa[Z * kBlock + i];
+        o[3] = soa[U * kBlock + i];
+        o[4] = soa[V * kBlock + i];
+      }
+      written += m;
+    });
+  });
+  return offsets[bands];
+}
+
+const char* deproject_kernel_name() {
+  return kernels().name;
+}
+
+} // namespace glfw
@@ -0,0 +1,44 @@
+/*
+ * deproject.h
+ *
+ */
+
+#ifndef DEPROJECT_H_
+#define DEPROJECT_H_
+
+#include "camera.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace glfw {
+
+// Everything needed to turn a z16 frame into points and color texture
+// coordinates, the way librealsense's pointcloud does: each pixel is
+// undistorted and deprojected with depth, moved into the color stream with
+// depth_to_color and projected (and distorted) with color.
+struct deprojection {
+  float depth_scale = 0.001f;  // meters per z16 unit
+  intrinsics depth;
+  intrinsics color;
+  extrinsics depth_to_color;
+};
+
+// Fill vertices (x, y, z) and tex_coords (u, v) for every pixel of depth,
+// in the layout drawDepthAndColorAsPointCloud takes; pixels without depth
+// get zeros. Rows of depth are stride pixels apart (0 for d.depth.width).
+// Returns how many pixels had a depth.
+size_t deproject_depth(float* vertices, float* tex_coords,
+                       const uint16_t* depth, int stride,
+                       const deprojection& d);
+
+// Write only the pixels with a depth, as interleaved x, y, z, u, v, into
+// out, which has room for every pixel. Returns how many were written.
+size_t deproject_points(float* out, const uint16_t* depth, int stride,
+                        const deprojection& d);
+
+const char* deproject_kernel_name();
+
+} // namespace glfw
+
+#endif /* DEPROJECT_H_ */
@@ -0,0 +1,528 @@
+/*
+ * depth_colorizer.cc
+ *
+ * Histogram-equalized colorization of z16 depth frames. The two per-pixel
+ * passes (histogram count and colorize) have SSE4.1, AVX2 and NEON versions
+ * picked once at runtime; all of them produce the same bytes as the scalar
+ * fallback. Large frames are further split into row bands on the worker pool.
+ */
+
+#include "depth_colorizer.h"
+#include "colormap.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define DEPTH_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define DEPTH_TARGET(isa)
+#else
+#define DEPTH_TARGET(isa) __attribute__((target(isa)))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define DEPTH_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace glfw {
+
+namespace {
+
+// Below this many pixels per band the partial histograms cost more than
+// the threads save.
+const size_t kMinBandPixels = 0x10000;
+
+// Incremental mode compares a coarse histogram (depth >> 10, plus one bin
+// for holes) of every kSampleStride-th pixel against the last rebuild.
+const int kSignatureBins = 0x10000 >> 10;
+const size_t kSampleStride = 61;
+
+struct depth_kernels {
+  const char* name;
+  // Count every non-zero depth value into histogram and return their range.
+  // Bin 0 (no data) is never read, so kernels are free to skip holes.
+  depth_range (*count)(uint32_t* histogram, const uint16_t* depth, size_t n);
+  // Write lut[depth[i]] as three bytes per pixel.
+  void (*colorize)(uint8_t* rgb, const uint16_t* depth, size_t n,
+                   const uint32_t* lut);
+};
+
+inline void put_rgb(uint8_t* p, uint32_t c) {
+  p[0] = uint8_t(c);
+  p[1] = uint8_t(c >> 8);
+  p[2] = uint8_t(c >> 16);
+}
+
+// The range is tracked as min(d - 1) so holes wrap around to 0xFFFF and
+// drop out of the minimum.
+inline depth_range make_range(uint16_t lo_minus_1, uint16_t hi) {
+  return { uint16_t(lo_minus_1 + 1), hi };
+}
+
+depth_range count_scalar(uint32_t* histogram, const uint16_t* depth,
+                         size_t n) {
+  uint16_t lo = 0xFFFF, hi = 0;
+  for (size_t i = 0; i < n; ++i) {
+    uint16_t d = depth[i];
+    ++histogram[d];
+    lo = std::min(lo, uint16_t(d - 1));
+    hi = std::max(hi, d);
+  }
+  return make_range(lo, hi);
+}
+
+void colorize_scalar(uint8_t* rgb, const uint16_t* depth, size_t n,
+                     const uint32_t* lut) {
+  for (size_t i = 0; i < n; ++i) put_rgb(rgb + i * 3, lut[depth[i]]);
+}
+
+#ifdef DEPTH_X86
+
+// Horizontal min of lo and max of hi; max(x) is ~min(~x).
+DEPTH_TARGET("sse4.1")
+depth_range reduce_range_sse41(__m128i lo, __m128i hi) {
+  const __m128i all = _mm_set1_epi16(-1);
+  uint16_t min_lo = uint16_t(_mm_cvtsi128_si32(_mm_minpos_epu16(lo)));
+  uint16_t max_hi = uint16_t(~_mm_cvtsi128_si32(
+      _mm_minpos_epu16(_mm_xor_si128(hi, all))));
+  return make_range(min_lo, max_hi);
+}
+
+DEPTH_TARGET("sse4.1")
+depth_range count_sse41(uint32_t* histogram, const uint16_t* depth,
+                        size_t n) {
+  const __m128i ones = _mm_set1_epi16(1);
+  __m128i lo = _mm_set1_epi16(-1), hi = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(depth + i));
+    if (_mm_testz_si128(v, v)) continue;
+    lo = _mm_min_epu16(lo, _mm_sub_epi16(v, ones));
+    hi = _mm_max_epu16(hi, v);
+    ++histogram[_mm_extract_epi16(v, 0)];
+    ++histogram[_mm_extract_epi16(v, 1)];
+    ++histogram[_mm_extract_epi16(v, 2)];
+    ++histogram[_mm_extract_epi16(v, 3)];
+    ++histogram[_mm_extract_epi16(v, 4)];
+    ++histogram[_mm_extract_epi16(v, 5)];
+    ++histogram[_mm_extract_epi16(v, 6)];
+    ++histogram[_mm_extract_epi16(v, 7)];
+  }
+  depth_range r = reduce_range_sse41(lo, hi);
+  r.merge(count_scalar(histogram, depth + i, n - i));
+  return r;
+}
+
+DEPTH_TARGET("sse4.1")
+void colorize_sse41(uint8_t* rgb, const uint16_t* depth, size_t n,
+                    const uint32_t* lut) {
+  // RGBX x4 -> RGB x4 in the low 12 bytes
+  const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                                     -1, -1, -1, -1);
+  size_t i = 0;
+  // Each 16 byte store spills 4 bytes past its pixels, keep it in bounds.
+  for (; i + 10 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(depth + i));
+    __m128i lo = _mm_cvtsi32_si128(int(lut[_mm_extract_epi16(v, 0)]));
+    lo = _mm_insert_epi32(lo, int(lut[_mm_extract_epi16(v, 1)]), 1);
+    lo = _mm_insert_epi32(lo, int(lut[_mm_extract_epi16(v, 2)]), 2);
+    lo = _mm_insert_epi32(lo, int(lut[_mm_extract_epi16(v, 3)]), 3);
+    __m128i hi = _mm_cvtsi32_si128(int(lut[_mm_extract_epi16(v, 4)]));
+    hi = _mm_insert_epi32(hi, int(lut[_mm_extract_epi16(v, 5)]), 1);
+    hi = _mm_insert_epi32(hi, int(lut[_mm_extract_epi16(v, 6)]), 2);
+    hi = _mm_insert_epi32(hi, int(lut[_mm_extract_epi16(v, 7)]), 3);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rgb + i * 3),
+                     _mm_shuffle_epi8(lo, pack));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rgb + i * 3 + 12),
+                     _mm_shuffle_epi8(hi, pack));
+  }
+  colorize_scalar(rgb + i * 3, depth + i, n - i, lut);
+}
+
+DEPTH_TARGET("avx2")
+depth_range count_avx2(uint32_t* histogram, const uint16_t* depth,
+                       size_t n) {
+  const __m256i ones = _mm256_set1_epi16(1);
+  __m256i lo = _mm256_set1_epi16(-1), hi = _mm256_setzero_si256();
+  size_t i = 0;
+  alignas(32) uint16_t d[16];
+  for (; i + 16 <= n; i += 16) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(depth + i));
+    if (_mm256_testz_si256(v, v)) continue;
+    lo = _mm256_min_epu16(lo, _mm256_sub_epi16(v, ones));
+    hi = _mm256_max_epu16(hi, v);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(d), v);
+    for (int k = 0; k < 16; ++k) ++histogram[d[k]];
+  }
+  __m128i lo128 = _mm_min_epu16(_mm256_castsi256_si128(lo),
+                                _mm256_extracti128_si256(lo, 1));
+  __m128i hi128 = _mm_max_epu16(_mm256_castsi256_si128(hi),
+                                _mm256_extracti128_si256(hi, 1));
+  depth_range r = reduce_range_sse41(lo128, hi128);
+  r.merge(count_scalar(histogram, depth + i, n - i));
+  return r;
+}
+
+DEPTH_TARGET("avx2")
+void colorize_avx2(uint8_t* rgb, const uint16_t* depth, size_t n,
+                   const uint32_t* lut) {
+  const __m256i pack = _mm256_setr_epi8(
+      0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+      0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  const int* table = reinterpret_cast<const int*>(lut);
+  size_t i = 0;
+  for (; i + 10 <= n; i += 8) {
+    __m256i idx = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(depth + i)));
+    __m256i c = _mm256_shuffle_epi8(_mm256_i32gather_epi32(table, idx, 4), pack);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rgb + i * 3),
+                     _mm256_castsi256_si128(c));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(rgb + i * 3 + 12),
+                     _mm256_extracti128_si256(c, 1));
+  }
+  colorize_scalar(rgb + i * 3, depth + i, n - i, lut);
+}
+
+bool cpu_has(bool avx2) {
+#ifdef _MSC_VER
+  int regs[4];
+  __cpuid(regs, 1);
+  bool sse41 = (regs[2] & (1 << 19)) != 0;
+  bool osxsave = (regs[2] & (1 << 27)) != 0;
+  if (!avx2) return sse41;
+  if (!osxsave || (_xgetbv(0) & 6) != 6) return false;
+  __cpuidex(regs, 7, 0);
+  return (regs[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return avx2 ? __builtin_cpu_supports("avx2") != 0
+              : __builtin_cpu_supports("sse4.1") != 0;
+#endif
+}
+
+#endif // DEPTH_X86
+
+#ifdef DEPTH_NEON
+
+depth_range count_neon(uint32_t* histogram, const uint16_t* depth,
+                       size_t n) {
+  const uint16x8_t ones = vdupq_n_u16(1);
+  uint16x8_t lo = vdupq_n_u16(0xFFFF), hi = vdupq_n_u16(0);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint16x8_t v = vld1q_u16(depth + i);
+    if (vmaxvq_u16(v) == 0) continue;
+    lo = vminq_u16(lo, vsubq_u16(v, ones));
+    hi = vmaxq_u16(hi, v);
+    ++histogram[vgetq_lane_u16(v, 0)];
+    ++histogram[vgetq_lane_u16(v, 1)];
+    ++histogram[vgetq_lane_u16(v, 2)];
+    ++histogram[vgetq_lane_u16(v, 3)];
+    ++histogram[vgetq_lane_u16(v, 4)];
+    ++histogram[vgetq_lane_u16(v, 5)];
+    ++histogram[vgetq_lane_u16(v, 6)];
+    ++histogram[vgetq_lane_u16(v, 7)];
+  }
+  depth_range r = make_range(vminvq_u16(lo), vmaxvq_u16(hi));
+  r.merge(count_scalar(histogram, depth + i, n - i));
+  return r;
+}
+
+void colorize_neon(uint8_t* rgb, const uint16_t* depth, size_t n,
+                   const uint32_t* lut) {
+  size_t i = 0;
+  uint32_t c[8];
+  for (; i + 8 <= n; i += 8) {
+    for (int k = 0; k < 8; ++k) c[k] = lut[depth[i + k]];
+    // De-interleave RGBX and store the first three planes as RGB
+    uint8x8x4_t px = vld4_u8(reinterpret_cast<const uint8_t*>(c));
+    uint8x8x3_t out = {{ px.val[0], px.val[1], px.val[2] }};
+    vst3_u8(rgb + i * 3, out);
+  }
+  colorize_scalar(rgb + i * 3, depth + i, n - i, lut);
+}
+
+#endif // DEPTH_NEON
+
+depth_kernels select_kernels() {
+#ifdef DEPTH_X86
+  if (cpu_has(true)) return { "avx2", count_avx2, colorize_avx2 };
+  if (cpu_has(false)) return { "sse4.1", count_sse41, colorize_sse41 };
+#endif
+#ifdef DEPTH_NEON
+  return { "neon", count_neon, colorize_neon };
+#endif
+  return { "scalar", count_scalar, colorize_scalar };
+}
+
+const depth_kernels& kernels() {
+  static const depth_kernels k = select_kernels();
+  return k;
+}
+
+// Turn the histogram into a cumulative one over [r.lo, r.hi] and bake
+// palette[f] into lut. Depths outside the range do not occur in the frame,
+// so their entries are left stale. f = histogram[d] * 255 / total is taken
+// from a double reciprocal and corrected so it matches the integer divide.
+void build_histogram_lut(uint32_t* histogram, uint32_t* lut, depth_range r,
+                         const uint32_t* palette) {
+  lut[0] = kNoDepthColor;
+  if (r.empty()) return;
+  for (int i = r.lo + 1; i <= r.hi; ++i) histogram[i] += histogram[i - 1];
+  const uint32_t total = histogram[r.hi];
+  const double inv = 1.0 / total;
+  for (int i = r.lo; i <= r.hi; ++i) {
+    uint32_t x = histogram[i] * 255;
+    uint32_t f = uint32_t(x * inv);
+    f += uint64_t(f + 1) * total <= x;
+    f -= uint64_t(f) * total > x;
+    lut[i] = palette[f];
+  }
+}
+
+// Depths below the range map to the start of the ramp, depths above it to
+// the end, as if they had been in the cumulative histogram.
+void fill_outside_range(uint32_t* lut, depth_range r,
+                        const uint32_t* palette) {
+  const uint32_t first = palette[0], last = palette[255];
+  if (r.empty()) {
+    std::fill(lut + 1, lut + 0x10000, first);
+    return;
+  }
+  std::fill(lut + 1, lut + r.lo, first);
+  std::fill(lut + r.hi + 1, lut + 0x10000, last);
+}
+
+void sample_distribution(std::vector<uint32_t>& bins, const uint16_t* depth,
+                         int width, int height, int stride) {
+  bins.assign(kSignatureBins + 1, 0);
+  const size_t n = size_t(width) * height;
+  for (size_t i = 0; i < n; i += kSampleStride) {
+    uint16_t d = depth[stride == width ? i : i / width * stride + i % width];
+    ++bins[d ? 1 + (d >> 10) : 0];
+  }
+}
+
+// Call fn(source offset, packed offset, pixels) over rows [first, last) of
+// a frame whose rows are stride pixels apart, in one call if they are
+// contiguous.
+template <typename Fn>
+void for_rows(int width, int stride, int first, int last, Fn fn) {
+  if (stride == width) {
+    const size_t begin = size_t(first) * width;
+    fn(begin, begin, size_t(last - first) * width);
+    return;
+  }
+  for (int row = first; row < last; ++row)
+    fn(size_t(row) * stride, size_t(row) * width, size_t(width));
+}
+
+float distribution_distance(const std::vector<uint32_t>& a,
+                            const std::vector<uint32_t>& b) {
+  double na = 0, nb = 0, sum = 0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    na += a[i];
+    nb += b[i];
+  }
+  if (!na || !nb) return na == nb ? 0.f : 1.f;
+  for (size_t i = 0; i < a.size(); ++i)
+    sum += std::abs(a[i] / na - b[i] / nb);
+  return float(sum / 2);
+}
+
+void clear_bins(uint32_t* histogram, depth_range r) {
+  histogram[0] = 0;
+  if (!r.empty())
+    memset(histogram + r.lo, 0, (r.hi - r.lo + 1) * sizeof(uint32_t));
+}
+
+} // namespace
+
+void depth_range::merge(const depth_range& r) {
+  if (r.empty()) return;
+  if (empty()) {
+    *this = r;
+    return;
+  }
+  lo = std::min(lo, r.lo);
+  hi = std::max(hi, r.hi);
+}
+
+const char* depth_kernel_name() {
+  return kernels().name;
+}
+
+depth_colorizer::depth_colorizer()
+    : histogram_(0x10000), lut_(0x10000), range_{0, 0}, lut_range_{0, 0} {
+}
+
+const uint8_t* depth_colorizer::colorize(const uint16_t* depth,
+                                         int width, int height, int stride) {
+  rgb_.resize(size_t(width) * height * 3);
+  colorize(rgb_.data(), depth, width, height, stride);
+  return rgb_.data();
+}
+
+void depth_colorizer::colorize(uint8_t* rgb, const uint16_t* depth,
+                               int width, int height, int stride) {
+  if (!stride) stride = width;
+  const uint32_t* lut = build_lut(depth, width, height, stride);
+  apply_lut(rgb, depth, width, height, stride, band_count(width, height),
+      lut);
+}
+
+const uint32_t* depth_colorizer::build_lut(const uint16_t* depth,
+                                           int width, int height,
+                                           int stride) {
+  const depth_kernels& k = kernels();
+  if (!stride) stride = width;
+  const unsigned bands = band_count(width, height);
+  const std::shared_ptr<const colormap> map =
+      colormap_ ? colormap_ : default_colormap();
+
+  ++frames_;
+  if (map->fixed_range()) {
+    active_ = map;
+    lut_range_ = { 1, 0xFFFF };
+    return map->lut();
+  }
+  if (map != baked_) {
+    // New palette, the cached table is useless
+    baked_ = map;
+    width_ = height_ = 0;
+  }
+  active_ = baked_;
+  if (interval_ && !needs_rebuild(depth, width, height, stride)) {
+    ++since_rebuild_;
+    return lut_.data();
+  }
+
+  if (bands <= 1) {
+    clear_bins(histogram_.data(), range_);
+    range_ = {0, 0};
+    for_rows(width, stride, 0, height, [&](size_t at, size_t, size_t n) {
+      range_.merge(k.count(histogram_.data(), depth + at, n));
+    });
+  } else {
+    count(depth, width, height, stride, bands);
+  }
+  build_histogram_lut(histogram_.data(), lut_.data(), range_, map->palette());
+  lut_range_ = range_;
+  ++rebuilds_;
+
+  if (interval_) {
+    // Later frames may hold depths this one did not have
+    fill_outside_range(lut_.data(), range_, map->palette());
+    lut_range_ = { 1, 0xFFFF };
+    reference_.swap(sample_);
+    since_rebuild_ = 0;
+    width_ = width;
+    height_ = height;
+  }
+  return lut_.data();
+}
+
+unsigned depth_colorizer::band_count(int width, int height) const {
+  const size_t n = size_t(width) * height;
+  return unsigned(std::min<size_t>(
+      std::min<size_t>(worker_pool::instance().size(), height),
+      n / kMinBandPixels));
+}
+
+void depth_colorizer::set_incremental(unsigned interval, float threshold) {
+  interval_ = interval;
+  threshold_ = threshold;
+  // Force a rebuild, the cached LUT may not cover every depth yet
+  width_ = height_ = 0;
+}
+
+void depth_colorizer::set_colormap(std::shared_ptr<const colormap> map) {
+  colormap_ = map;
+}
+
+bool depth_colorizer::needs_rebuild(const uint16_t* depth,
+                                    int width, int height, int stride) {
+  sample_distribution(sample_, depth, width, height, stride);
+  if (width != width_ || height != height_ || since_rebuild_ + 1 >= interval_)
+    return true;
+  return distribution_distance(sample_, reference_) > threshold_;
+}
+
+void depth_colorizer::apply_lut(uint8_t* rgb, const uint16_t* depth,
+                                int width, int height, int stride,
+                                unsigned bands, const uint32_t* lut) {
+  const depth_kernels& k = kernels();
+  auto colorize_rows = [&](int first, int last) {
+    for_rows(width, stride, first, last, [&](size_t at, size_t to, size_t n) {
+      k.colorize(rgb + to * 3, depth + at, n, lut);
+    });
+  };
+  if (bands <= 1) {
+    colorize_rows(0, height);
+    return;
+  }
+  worker_pool::instance().run(bands, [&](unsigned b) {
+    colorize_rows(int(size_t(height) * b / bands),
+        int(size_t(height) * (b + 1) / bands));
+  });
+}
+
+void depth_colorizer::count(const uint16_t* depth, int width, int height,
+                            int stride, unsigned bands) {
+  const depth_kernels& k = kernels();
+  worker_pool& pool = worker_pool::instance();
+
+  // Count each row band into its own partial histogram...
+  if (partials_.size() != bands) {
+    partials_.resize(bands);
+    for (auto& p : partials_) {
+      if (p.bins.empty()) {
+        p.bins.resize(0x10000);
+        p.range = {0, 0};
+      }
+    }
+  }
+  pool.run(bands, [&](unsigned b) {
+    partial& p = partials_[b];
+    clear_bins(p.bins.data(), p.range);
+    p.range = {0, 0};
+    for_rows(width, stride, int(size_t(height) * b / bands),
+        int(size_t(height) * (b + 1) / bands),
+        [&](size_t at, size_t, size_t n) {
+      p.range.merge(k.count(p.bins.data(), depth + at, n));
+    });
+  });
+
+  clear_bins(histogram_.data(), range_);
+  range_ = {0, 0};
+  for (auto& p : partials_) range_.merge(p.range);
+  if (range_.empty()) return;
+
+  // ...then reduce them, each thread summing its own share of the range.
+  const depth_range r = range_;
+  pool.run(bands, [&](unsigned b) {
+    const size_t span = size_t(r.hi - r.lo) + 1;
+    const size_t lo = r.lo + span * b / bands;
+    const size_t hi = r.lo + span * (b + 1) / bands;
+    for (size_t i = lo; i < hi; ++i) {
+      uint32_t sum = 0;
+      for (auto& p : partials_) sum += p.bins[i];
+      histogram_[i] = sum;
+    }
+  });
+}
+
+void make_depth_histogram(uint8_t rgb_image[],
+    const uint16_t depth_image[], int width, int height)
+{
+  static depth_colorizer colorizer;
+  colorizer.colorize(rgb_image, depth_image, width, height);
+}
+
+} // namespace glfw
@@ -0,0 +1,109 @@
+/*
+ * depth_colorizer.h
+ *
+ */
+
+#ifndef DEPTH_COLORIZER_H_
+#define DEPTH_COLORIZER_H_
+
+#include "colormap.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace glfw {
+
+// Smallest and largest non-zero depth of a frame; hi == 0 when it had none.
+struct depth_range {
+  uint16_t lo, hi;
+  bool empty() const { return hi == 0; }
+  void merge(const depth_range& r);
+};
+
+// Colorizer for one z16 stream. Each instance owns its histogram, lookup
+// table and output buffer, so streams can be colorized independently; only
+// the bins touched by the previous frame are cleared. Fixed range colormaps
+// skip the histogram and use the colormap's baked table directly.
+class depth_colorizer {
+ public:
+  depth_colorizer();
+
+  // Rows of depth are stride pixels apart (0 for width); the output is
+  // always tightly packed.
+
+  // Colorize into the internal buffer, valid until the next call.
+  const uint8_t* colorize(const uint16_t* depth, int width, int height,
+                          int stride = 0);
+  // Colorize into rgb, which must hold width * height * 3 bytes.
+  void colorize(uint8_t* rgb, const uint16_t* depth, int width, int height,
+                int stride = 0);
+
+  // Everything but the colorize pass: returns the 64K-entry depth to color
+  // table (packed 0x00BBGGRR) for this frame, valid until the next call.
+  const uint32_t* build_lut(const uint16_t* depth, int width, int height,
+                            int stride = 0);
+  // Every depth of the last frame falls inside this range of the table;
+  // entries outside it may be stale.
+  depth_range lut_range() const { return lut_range_; }
+  // Colormap the last table was built from
+  const std::shared_ptr<const colormap>& active_colormap() const {
+    return active_;
+  }
+
+  // Rebuild the histogram mapping only every interval frames, or sooner when
+  // the sampled depth distribution moves by more than threshold (total
+  // variation distance, 0..1). Frames in between are a single lookup pass
+  // through the cached LUT. An interval of 0 rebuilds every frame.
+  void set_incremental(unsigned interval, float threshold);
+
+  // Use map instead of the default colormap; null follows the default again.
+  void set_colormap(std::shared_ptr<const colormap> map);
+
+  unsigned long frames() const { return frames_; }
+  unsigned long rebuilds() const { return rebuilds_; }
+
+ private:
+  struct partial {
+    std::vector<uint32_t> bins;
+    depth_range range;
+  };
+
+  void count(const uint16_t* depth, int width, int height, int stride,
+             unsigned bands);
+  void apply_lut(uint8_t* rgb, const uint16_t* depth, int width, int height,
+                 int stride, unsigned bands, const uint32_t* lut);
+  bool needs_rebuild(const uint16_t* depth, int width, int height,
+                     int stride);
+  unsigned band_count(int width, int height) const;
+
+  std::vector<uint32_t> histogram_;
+  std::vector<uint32_t> lut_;
+  depth_range range_;
+  std::vector<partial> partials_;
+  std::vector<uint8_t> rgb_;
+  std::shared_ptr<const colormap> colormap_;
+  std::shared_ptr<const colormap> baked_;  // palette currently in lut_
+  std::shared_ptr<const colormap> active_;
+  depth_range lut_range_;
+
+  unsigned interval_ = 0;
+  float threshold_ = 0;
+  unsigned since_rebuild_ = 0;
+  int width_ = 0, height_ = 0;
+  std::vector<uint32_t> reference_;  // sampled distribution at last rebuild
+  std::vector<uint32_t> sample_;
+  unsigned long frames_ = 0, rebuilds_ = 0;
+};
+
+// Colorize a z16 frame into tightly packed RGB8 with the default colormap.
+void make_depth_histogram(uint8_t rgb_image[],
+    const uint16_t depth_image[], int width, int height);
+
+// Name of the kernel set picked at runtime ("avx2", "sse4.1", "neon", "scalar")
+const char* depth_kernel_name();
+
+} // namespace glfw
+
+#endif /* DEPTH_COLORIZER_H_ */
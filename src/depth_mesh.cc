@@ -0,0 +1,279 @@
+/*
+ * depth_mesh.cc
+ *
+ * Triangles are laid out in the index buffer cell by cell in row order,
+ * the two of each cell next to each other, so that the kept ones form long
+ * runs wherever the surface is continuous and a frame is drawn with one
+ * glMultiDrawElements. Finding the runs is split into bands of rows across
+ * the worker pool; runs that meet at a band boundary are joined. Most
+ * drivers draw each run on its own, so past kMaxRuns the kept triangles'
+ * indices are written into a streamed index buffer instead, again in bands.
+ */
+
+#include "depth_mesh.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace glfw {
+
+namespace {
+
+// Fewer cells than this per band are not worth splitting
+const size_t kMinBandCells = 0x10000;
+// More runs than this are drawn from compacted indices
+const size_t kMaxRuns = 1024;
+
+inline bool close(const float* a, const float* b, float limit) {
+  const float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+  return dx * dx + dy * dy + dz * dz <= limit;
+}
+
+} // namespace
+
+depth_mesh::~depth_mesh() {
+  if (vbo_)
+    glDeleteBuffers(1, &vbo_);
+  if (ibo_)
+    glDeleteBuffers(1, &ibo_);
+  if (compact_ibo_)
+    glDeleteBuffers(1, &compact_ibo_);
+}
+
+void depth_mesh::build_indices(uint32_t width, uint32_t height) {
+  width_ = width;
+  height_ = height;
+  indices_.clear();
+  if (width < 2 || height < 2)
+    return;
+  indices_.reserve(size_t(width - 1) * (height - 1) * 6);
+  for (uint32_t y = 0; y + 1 < height; y++) {
+    for (uint32_t x = 0; x + 1 < width; x++) {
+      const GLuint i = y * width + x;
+      const GLuint cell[6] = {
+        i,     i + width, i + 1,
+        i + 1, i + width, i + width + 1,
+      };
+      indices_.insert(indices_.end(), cell, cell + 6);
+    }
+  }
+
+  if (!GLEW_VERSION_1_5)
+    return;
+  if (!ibo_)
+    glGenBuffers(1, &ibo_);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo_);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices_.size() * sizeof(GLuint),
+      indices_.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  indices_.clear();
+  indices_.shrink_to_fit();
+}
+
+void depth_mesh::find_runs(const float* vertices, float max_edge) {
+  const size_t width = width_, cells_wide = width_ - 1, rows = height_ - 1;
+  const float limit = max_edge > 0 ? max_edge * max_edge : INFINITY;
+  const unsigned bands = unsigned(std::max<size_t>(1, std::min<size_t>(
+      std::min<size_t>(worker_pool::instance().size(), rows),
+      cells_wide * rows / kMinBandCells)));
+
+  std::vector<triangle_runs> band_runs(bands);
+  auto band = [&](unsigned b) {
+    triangle_runs& runs = band_runs[b];
+    size_t start = 0, count = 0;
+    auto keep = [&](size_t t) {
+      if (count && start + count == t) {
+        count++;
+        return;
+      }
+      if (count)
+        runs.emplace_back(start, count);
+      start = t;
+      count = 1;
+    };
+    const size_t first = rows * b / bands, last = rows * (b + 1) / bands;
+    for (size_t y = first; y < last; y++) {
+      for (size_t x = 0; x < cells_wide; x++) {
+        // a b
+        // c d
+        const float* a = vertices + (y * width + x) * 3;
+        const float* c = a + width * 3;
+        const float* bp = a + 3;
+        const float* d = c + 3;
+        if (!bp[2] || !c[2] || !close(bp, c, limit))
+          continue;
+        const size_t t = (y * cells_wide + x) * 2;
+        if (a[2] && close(a, bp, limit) && close(a, c, limit))
+          keep(t);
+        if (d[2] && close(bp, d, limit) && close(c, d, limit))
+          keep(t + 1);
+      }
+    }
+    if (count)
+      runs.emplace_back(start, count);
+  };
+  if (bands <= 1)
+    band(0);
+  else
+    worker_pool::instance().run(bands, band);
+
+  size_t runs = 0;
+  for (const triangle_runs& r : band_runs)
+    runs += r.size();
+  run_counts_.clear();
+  run_offsets_.clear();
+  triangles_ = 0;
+  compacted_ = runs > kMaxRuns;
+  if (compacted_)
+    compact(band_runs);
+  else
+    join_runs(band_runs);
+}
+
+void depth_mesh::join_runs(const std::vector<triangle_runs>& band_runs) {
+  size_t start = 0, count = 0;
+  auto flush = [&]() {
+    if (!count)
+      return;
+    // Offsets into the index buffer, or pointers into indices_ without one
+    const size_t first = start * 3;
+    run_counts_.push_back(GLsizei(count * 3));
+    run_offsets_.push_back(ibo_ ?
+        reinterpret_cast<const GLvoid*>(first * sizeof(GLuint)) :
+        indices_.data() + first);
+    triangles_ += count;
+  };
+  for (const triangle_runs& runs : band_runs) {
+    for (const std::pair<size_t, size_t>& run : runs) {
+      if (count && start + count == run.first) {
+        count += run.second;
+        continue;
+      }
+      flush();
+      start = run.first;
+      count = run.second;
+    }
+  }
+  flush();
+}
+
+void depth_mesh::compact(const std::vector<triangle_runs>& band_runs) {
+  // Where each band's triangles start in compact_
+  const size_t bands = band_runs.size();
+  std::vector<size_t> band_first(bands + 1, 0);
+  for (size_t b = 0; b < bands; b++) {
+    size_t count = 0;
+    for (const std::pair<size_t, size_t>& run : band_runs[b])
+      count += run.second;
+    band_first[b + 1] = band_first[b] + count;
+  }
+  triangles_ = band_first[bands];
+  compact_.resize(triangles_ * 3);
+
+  const GLuint width = width_, cells_wide = width_ - 1;
+  auto band = [&](unsigned b) {
+    GLuint* out = compact_.data() + band_first[b] * 3;
+    for (const std::pair<size_t, size_t>& run : band_runs[b]) {
+      for (size_t t = run.first; t < run.first + run.second; t++) {
+        // As build_indices() lays them out
+        const GLuint cell = GLuint(t / 2);
+        const GLuint i = cell / cells_wide * width + cell % cells_wide;
+        if (t % 2 == 0) {
+          out[0] = i;
+          out[1] = i + width;
+          out[2] = i + 1;
+        } else {
+          out[0] = i + 1;
+          out[1] = i + width;
+          out[2] = i + width + 1;
+        }
+        out += 3;
+      }
+    }
+  };
+  if (bands <= 1)
+    band(0);
+  else
+    worker_pool::instance().run(unsigned(bands), band);
+
+  if (!GLEW_VERSION_1_5)
+    return;
+  if (!compact_ibo_)
+    glGenBuffers(1, &compact_ibo_);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, compact_ibo_);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, compact_.size() * sizeof(GLuint),
+      compact_.data(), GL_STREAM_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+size_t depth_mesh::update(const float* vertices, const float* tex_coords,
+                          uint32_t width, uint32_t height, float max_edge) {
+  if (width != width_ || height != height_)
+    build_indices(width, height);
+  if (width < 2 || height < 2) {
+    triangles_ = 0;
+    run_counts_.clear();
+    run_offsets_.clear();
+    return 0;
+  }
+
+  const size_t points = size_t(width) * height;
+  if (GLEW_VERSION_1_5) {
+    // Positions, then texture coordinates
+    if (!vbo_)
+      glGenBuffers(1, &vbo_);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    glBufferData(GL_ARRAY_BUFFER, points * 5 * sizeof(float), nullptr,
+        GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, points * 3 * sizeof(float),
+        vertices);
+    glBufferSubData(GL_ARRAY_BUFFER, points * 3 * sizeof(float),
+        points * 2 * sizeof(float), tex_coords);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  } else {
+    vertices_.assign(vertices, vertices + points * 3);
+    tex_coords_.assign(tex_coords, tex_coords + points * 2);
+  }
+  find_runs(vertices, max_edge);
+  return triangles_;
+}
+
+void depth_mesh::draw() const {
+  if (!triangles_)
+    return;
+  const float* positions = vertices_.data();
+  const float* tex_coords = tex_coords_.data();
+  const GLuint* compacted = compact_.data();
+  if (vbo_) {
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, compacted_ ? compact_ibo_ : ibo_);
+    // Offsets into the buffers
+    positions = nullptr;
+    tex_coords = reinterpret_cast<const float*>(
+        size_t(width_) * height_ * 3 * sizeof(float));
+    compacted = nullptr;
+  }
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glVertexPointer(3, GL_FLOAT, 0, positions);
+  glTexCoordPointer(2, GL_FLOAT, 0, tex_coords);
+  if (compacted_) {
+    glDrawElements(GL_TRIANGLES, GLsizei(triangles_ * 3), GL_UNSIGNED_INT,
+        compacted);
+  } else {
+    // GLEW declares the offsets non-const; they are only read
+    glMultiDrawElements(GL_TRIANGLES, run_counts_.data(), GL_UNSIGNED_INT,
+        const_cast<const GLvoid**>(run_offsets_.data()),
+        GLsizei(run_counts_.size()));
+  }
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  if (vbo_) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+}
+
+} // namespace glfw
@@ -0,0 +1,72 @@
+/*
+ * depth_mesh.h
+ *
+ */
+
+#ifndef DEPTH_MESH_H_
+#define DEPTH_MESH_H_
+
+#include "shader.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace glfw {
+
+// The organized points of a depth frame drawn as a surface: two triangles
+// between every 2x2 block of neighbouring pixels. The index buffer holds all
+// of them and is only built when the frame size changes; each update uploads
+// the vertices and finds the triangles to draw, leaving out those with a
+// corner without depth or an edge longer than max_edge (depth
+// discontinuities), which are then drawn as runs from the index buffer.
+// Frames that break up into too many runs (noisy ones) have the indices
+// of their kept triangles written out instead and drawn with one call.
+// Needs a current context for its whole lifetime.
+class depth_mesh {
+ public:
+  depth_mesh() = default;
+  ~depth_mesh();
+
+  // Replace the surface with width x height vertices (x, y, z) and
+  // tex_coords (u, v) in row order; returns the triangles kept
+  size_t update(const float* vertices, const float* tex_coords,
+                uint32_t width, uint32_t height, float max_edge);
+
+  // Draw the kept triangles with the current texture and transforms
+  void draw() const;
+
+  size_t size() const { return triangles_; }
+
+ private:
+  depth_mesh(const depth_mesh&) = delete;
+  depth_mesh& operator=(const depth_mesh&) = delete;
+
+  // Runs as first triangle and triangle count
+  typedef std::vector<std::pair<size_t, size_t>> triangle_runs;
+
+  void build_indices(uint32_t width, uint32_t height);
+  void find_runs(const float* vertices, float max_edge);
+  void join_runs(const std::vector<triangle_runs>& band_runs);
+  void compact(const std::vector<triangle_runs>& band_runs);
+
+  uint32_t width_ = 0, height_ = 0;
+  GLuint vbo_ = 0, ibo_ = 0;
+  // Runs of kept triangles, as index counts and offsets for
+  // glMultiDrawElements
+  std::vector<GLsizei> run_counts_;
+  std::vector<const GLvoid*> run_offsets_;
+  // Or the indices of the kept triangles, streamed into compact_ibo_
+  bool compacted_ = false;
+  std::vector<GLuint> compact_;
+  GLuint compact_ibo_ = 0;
+  size_t triangles_ = 0;
+  // Where there are no buffer objects
+  std::vector<GLuint> indices_;
+  std::vector<float> vertices_, tex_coords_;
+};
+
+} // namespace glfw
+
+#endif /* DEPTH_MESH_H_ */
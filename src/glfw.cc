@@ -1,4 +1,20 @@
 #include "common.h"
+#include "accumulation.h"
+#include "camera.h"
+#include "colormap.h"
+#include "depth_colorizer.h"
+#include "depth_mesh.h"
+#include "gpu_colorizer.h"
+#include "mosaic.h"
+#include "pixel_format.h"
+#include "point_cloud.h"
+#include "point_index.h"
+#include "point_sprites.h"
+#include "texture_upload.h"
+#include "worker_pool.h"
+#include "yuv.h"
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 
@@ -6,6 +22,8 @@ using namespace v8;
 using namespace node;
 
 #include <vector>
+#include <map>
+#include <memory>
 #include <string>
 #include <iostream>
 using namespace std;
@@ -29,7 +47,10 @@ JS_METHOD(Init) {
   SET_RETURN_VALUE(JS_BOOL(glfwInit()==GL_TRUE));
 }
 
+static void release_all_window_objects();
+
 JS_METHOD(Terminate) {
+  release_all_window_objects();
   glfwTerminate();
   SET_RETURN_VALUE(Nan::Undefined());
 }
@@ -120,30 +141,6 @@ Nan::Persistent<v8::Object> glfw_events;
 int lastX=0,lastY=0;
 bool windowCreated=false;
 
-inline void make_depth_histogram(uint8_t rgb_image[],
-    const uint16_t depth_image[], int width, int height)
-{
-  static uint32_t histogram[0x10000];
-  memset(histogram, 0, sizeof(histogram));
-
-  for (auto i = 0; i < width*height; ++i) ++histogram[depth_image[i]];
-  // Build a cumulative histogram for the indices in [1,0xFFFF]
-  for (auto i = 2; i < 0x10000; ++i) histogram[i] += histogram[i - 1];
-  for (auto i = 0; i < width*height; ++i) {
-    if (auto d = depth_image[i]) {
-      // 0-255 based on histogram location
-      int f = histogram[d] * 255 / histogram[0xFFFF];
-      rgb_image[i * 3 + 0] = 255 - f;
-      rgb_image[i * 3 + 1] = 0;
-      rgb_image[i * 3 + 2] = f;
-    } else {
-      rgb_image[i * 3 + 0] = 20;
-      rgb_image[i * 3 + 1] = 5;
-      rgb_image[i * 3 + 2] = 0;
-    }
-  }
-}
-
 struct Rect {
   float x;
   float y;
@@ -166,8 +163,75 @@ struct Rect {
   }
 };
 
-static void _DrawImage2D(const Rect& r, const std::string& type,
+// A pixel format argument: a FORMAT_* id, or the format's name
+static pixel_format format_arg(Local<Value> value) {
+  if (value->IsNumber())
+    return pixel_format_from_id(Nan::To<int32_t>(value).FromJust());
+  Nan::Utf8String name(value);
+  return pixel_format_from_name(*name);
+}
+
+// Frame options { stride, x, y, frame }: bytes between rows of the buffer,
+// the pixel offset of the frame within it, and a frame number or timestamp
+// that lets an unchanged frame skip its upload. All are optional.
+static frame_layout layout_arg(Local<Value> value) {
+  frame_layout layout;
+  if (!value->IsObject())
+    return layout;
+  Local<Object> object = value.As<Object>();
+  auto field = [&](const char* name) {
+    Local<Value> v =
+        Nan::Get(object, JS_STR(name).ToLocalChecked()).ToLocalChecked();
+    return v->IsUndefined() ? 0u : Nan::To<uint32_t>(v).FromJust();
+  };
+  layout.stride = field("stride");
+  layout.x = field("x");
+  layout.y = field("y");
+  return layout;
+}
+
+static double frame_arg(Local<Value> value) {
+  if (!value->IsObject())
+    return kNoFrame;
+  Local<Value> frame = Nan::Get(value.As<Object>(),
+      JS_STR("frame").ToLocalChecked()).ToLocalChecked();
+  return frame->IsNumber() ? Nan::To<double>(frame).FromJust() : kNoFrame;
+}
+
+// Throws and returns false unless a frame of format, laid out as given,
+// fits into a buffer of bytes
+static bool check_frame(pixel_format format, uint32_t width, uint32_t height,
+                        const frame_layout& layout, size_t bytes) {
+  if (!format) {
+    ThrowTypeError("Unknown pixel format");
+    return false;
+  }
+  if (!frame_size_valid(format, width, height)) {
+    ThrowRangeError("Frame size does not fit the pixel format");
+    return false;
+  }
+  const size_t span = frame_span(format, width, height, layout);
+  if (!layout.packed() && !span) {
+    ThrowRangeError("Stride and offsets do not fit the frame");
+    return false;
+  }
+  if (span > bytes) {
+    ThrowRangeError("Buffer is smaller than the frame");
+    return false;
+  }
+  return true;
+}
+
+// raw_formats false converts z16 and YUV frames on the CPU even where a
+// shader could, for draws that bring their own program
+void upload_texture(GLuint texture, uint8_t* data, uint32_t width,
+    uint32_t height, pixel_format format, depth_colorizer* colorizer = nullptr,
+    const frame_layout& layout = frame_layout(), double frame = kNoFrame,
+    bool raw_formats = true);
+
+static void _DrawImage2D(const Rect& r, pixel_format format,
                          const void* data, int width, int height,
+                         const frame_layout& layout, double frame,
                          float alpha = 1.0) {
   static GLuint texture = 0;
 
@@ -175,26 +239,9 @@ static void _DrawImage2D(const Rect& r, const std::string& type,
   if (!texture) {
     glGenTextures(1, &texture);
   }
-  glBindTexture(GL_TEXTURE_2D, texture);
-
-  if (type == "z16") {
-    std::vector<uint8_t> rgb;
-    rgb.resize(width * height * 4);
-    make_depth_histogram(rgb.data(),
-        reinterpret_cast<const uint16_t *>(data), width, height);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height,
-        0, GL_RGB, GL_UNSIGNED_BYTE, rgb.data());
-  } else if (type == "rgb8") {
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height,
-        0, GL_RGB, GL_UNSIGNED_BYTE, data);
-  }
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-  glBindTexture(GL_TEXTURE_2D, 0);
+  static depth_colorizer colorizer;
+  upload_texture(texture, (uint8_t*)data, width, height, format, &colorizer,
+      layout, frame);
 
   // Show
   glEnable(GL_BLEND);
@@ -210,12 +257,18 @@ static void _DrawImage2D(const Rect& r, const std::string& type,
 
   glBindTexture(GL_TEXTURE_2D, texture);
   glEnable(GL_TEXTURE_2D);
+  const bool raw_depth = begin_depth_draw(texture);
+  const bool raw_yuv = !raw_depth && begin_yuv_draw(texture);
   glBegin(GL_QUADS);
   glTexCoord2f(0, 0); glVertex2f(r.x, r.y);
   glTexCoord2f(1, 0); glVertex2f(r.x + r.w, r.y);
   glTexCoord2f(1, 1); glVertex2f(r.x + r.w, r.y + r.h);
   glTexCoord2f(0, 1); glVertex2f(r.x, r.y + r.h);
   glEnd();
+  if (raw_depth)
+    end_depth_draw();
+  if (raw_yuv)
+    end_yuv_draw();
   glDisable(GL_TEXTURE_2D);
   glBindTexture(GL_TEXTURE_2D, 0);
 
@@ -228,12 +281,15 @@ JS_METHOD(drawImage2D) {
   const int width = Nan::To<uint32_t>(info[2]).FromJust();   // Viewport width
   const int height = Nan::To<uint32_t>(info[3]).FromJust();  // Viewport height
 
-  Nan::Utf8String str(info[4]); // Buffer type
-  std::string type = *str;
+  pixel_format format = format_arg(info[4]); // Buffer type
   Nan::TypedArrayContents<uint16_t> buffer(info[5].As<Uint16Array>());
   const void* data = *buffer; // Buffer pointer
   const int data_width = Nan::To<uint32_t>(info[6]).FromJust();  // Buffer width
   const int data_height = Nan::To<uint32_t>(info[7]).FromJust(); // Buffer height
+  frame_layout layout = layout_arg(info[8]); // Stride and offsets
+  if (!check_frame(format, data_width, data_height, layout,
+                   buffer.length() * sizeof(uint16_t)))
+    return;
 
   Rect r;
   r.x = x;
@@ -246,7 +302,8 @@ JS_METHOD(drawImage2D) {
   glPushMatrix();
   glOrtho(0, width, height, 0, -1, +1);
 
-  _DrawImage2D(r, type, data, data_width, data_height);
+  _DrawImage2D(r, format, data, data_width, data_height, layout,
+      frame_arg(info[8]));
 
   glPopMatrix();
 }
@@ -268,59 +325,88 @@ void show(GLuint tex,
         return;
     glBindTexture(GL_TEXTURE_2D, tex);
     glEnable(GL_TEXTURE_2D);
+    const bool raw_depth = begin_depth_draw(tex);
+    const bool raw_yuv = !raw_depth && begin_yuv_draw(tex);
     glBegin(GL_QUAD_STRIP);
     glTexCoord2f(0.f, 1.f); glVertex2f(r.x, r.y + r.h);
     glTexCoord2f(0.f, 0.f); glVertex2f(r.x, r.y);
     glTexCoord2f(1.f, 1.f); glVertex2f(r.x + r.w, r.y + r.h);
     glTexCoord2f(1.f, 0.f); glVertex2f(r.x + r.w, r.y);
     glEnd();
+    if (raw_depth)
+        end_depth_draw();
+    if (raw_yuv)
+        end_yuv_draw();
     glDisable(GL_TEXTURE_2D);
     glBindTexture(GL_TEXTURE_2D, 0);
 
     // draw_text(r.x + 15, r.y + 20, rs2_stream_to_string(stream));
 }
 
+// z16 streams that do not bring their own colorizer share this one
+static depth_colorizer shared_colorizer;
+
 void upload_texture(
     GLuint texture,
     uint8_t* data,
     uint32_t width,
     uint32_t height,
-    const std::string& format) {
-    static std::vector<uint8_t> rgb;
-    // If the frame timestamp has changed
-    //  since the last time show (...) was called, re-upload the texture
+    pixel_format format,
+    depth_colorizer* colorizer,
+    const frame_layout& layout,
+    double frame,
+    bool raw_formats) {
+    // Only re-upload when the frame differs from what texture shows
+    if (std::isnan(frame))
+      forget_frame(texture);
+    else if (frame_cached(texture,
+                 { frame, format, width, height, data, layout }))
+      return;
+
+    if (format == PIXEL_FORMAT_Z16 && raw_formats && gpu_colorize_enabled()) {
+      forget_yuv_texture(texture);
+      upload_depth_texture(texture, reinterpret_cast<const uint16_t *>(data),
+          width, height, layout, colorizer ? *colorizer : shared_colorizer);
+      return;
+    }
+    forget_depth_texture(texture);
+    if (is_yuv_format(format) && raw_formats && yuv_on_gpu(format, layout)) {
+      upload_yuv_texture(texture, data, width, height, format, layout);
+      return;
+    }
+    forget_yuv_texture(texture);
 
     glBindTexture(GL_TEXTURE_2D, texture);
 
-    // glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
-
-    if (format == "z16") {
-      rgb.resize(width * height * 4);
-      make_depth_histogram(rgb.data(),
-          reinterpret_cast<const uint16_t *>(data),
-          width, height);
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height,
-          0, GL_RGB, GL_UNSIGNED_BYTE, rgb.data());
-    } else if (format == "rgb8") {
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height,
-          0, GL_RGB, GL_UNSIGNED_BYTE, data);
-    } else if (format == "y8") {
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height,
-          0, GL_LUMINANCE, GL_UNSIGNED_BYTE, data);
-    } else if (format == "raw8") {
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, width, height,
-          0, GL_LUMINANCE, GL_UNSIGNED_BYTE, data);
-    } else if (format == "y16") {
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, width, height,
-          0, GL_LUMINANCE, GL_UNSIGNED_SHORT, data);
+    const pixel_format_traits& traits = format_traits(format);
+    const size_t pixel_bytes = traits.bits_per_pixel / 8;
+    const size_t stride = layout.stride ? layout.stride : width * pixel_bytes;
+    // Converters read the frame from where it starts...
+    const uint8_t* origin = data + layout.y * stride + layout.x * pixel_bytes;
+    if (format == PIXEL_FORMAT_Z16) {
+      if (!colorizer)
+        colorizer = &shared_colorizer;
+      const uint8_t* rgb = colorizer->colorize(
+          reinterpret_cast<const uint16_t *>(origin), width, height,
+          int(stride / 2));
+      upload_texture_image(texture, traits.internal_format, width, height,
+          traits.format, traits.type, rgb);
+    } else if (is_yuv_format(format)) {
+      static std::vector<uint8_t> rgba;
+      rgba.resize(size_t(width) * height * 4);
+      convert_yuv_to_rgba(rgba.data(), origin, width, height, format, stride);
+      upload_texture_image(texture, traits.internal_format, width, height,
+          traits.format, traits.type, rgba.data());
     } else {
-      printf("Error: not supported color format in glfw: %s\n", format.c_str());
+      // ...GL is told where it starts
+      unpack_layout unpack(layout, unsigned(pixel_bytes));
+      upload_texture_image(texture, traits.internal_format, width, height,
+          traits.format, traits.type, data);
     }
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
@@ -367,38 +453,22 @@ void register_callbacks(GLFWwindow* window) {
   });
 }
 
-JS_METHOD(drawDepthAndColorAsPointCloud) {
-  size_t argIndex = 0;
-  GLFWwindow* win =
-      reinterpret_cast<GLFWwindow*>(Nan::To<int64_t>(info[argIndex++]).FromJust());
-
-  Nan::TypedArrayContents<float> buffer0(info[argIndex++].As<Float32Array>());
-  const float3* vertices = reinterpret_cast<float3*>(*buffer0);
-
-  uint32_t point_count = Nan::To<int32_t>(info[argIndex++]).FromJust();
-
-  Nan::TypedArrayContents<float> buffer1(info[argIndex++].As<Float32Array>());
-  const float2* tex_coords = reinterpret_cast<float2*>(*buffer1);
-
-  Nan::TypedArrayContents<uint8_t> buffer2(info[argIndex++].As<Uint8Array>());
-  uint8_t* color = *buffer2;
-
-  uint32_t color_width = Nan::To<uint32_t>(info[argIndex++]).FromJust();
-  uint32_t color_height = Nan::To<uint32_t>(info[argIndex++]).FromJust();
-  Nan::Utf8String str0(info[argIndex++]);
-  std::string color_format_str = *str0;
+// The orbit camera as the point cloud was last drawn with it, for picking
+struct orbit_view {
+  GLdouble modelview[16], projection[16];
+  int width, height;
+};
+static orbit_view last_orbit_view = {};
 
+// Set up the orbit camera (driven by the mouse callbacks) for drawing a
+// point cloud textured with tex; end_orbit_view() restores the state
+static void begin_orbit_view(GLFWwindow* win, GLuint tex) {
   static bool first = true;
   if (first) {
     first = false;
     register_callbacks(win);
   }
-  static GLuint tex = 0;
-  if (!tex)
-    glGenTextures(1, &tex);
 
-  if (color)
-    upload_texture(tex, color, color_width, color_height, color_format_str);
   glPopMatrix();
   glPushAttrib(GL_ALL_ATTRIB_BITS);
   int32_t winW, winH;
@@ -421,6 +491,10 @@ JS_METHOD(drawDepthAndColorAsPointCloud) {
   glRotated(app_state.pitch, 1, 0, 0);
   glRotated(app_state.yaw, 0, 1, 0);
   glTranslatef(0, 0, -0.5f);
+  glGetDoublev(GL_MODELVIEW_MATRIX, last_orbit_view.modelview);
+  glGetDoublev(GL_PROJECTION_MATRIX, last_orbit_view.projection);
+  last_orbit_view.width = winW;
+  last_orbit_view.height = winH;
 
   glPointSize(width / 640);
   glEnable(GL_DEPTH_TEST);
@@ -430,22 +504,9 @@ JS_METHOD(drawDepthAndColorAsPointCloud) {
   glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, tex_border_color);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, 0x812F); // GL_CLAMP_TO_EDGE
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, 0x812F); // GL_CLAMP_TO_EDGE
-  glBegin(GL_POINTS);
-
-
-  /* this segment actually prints the pointcloud */
-  for (uint32_t i = 0; i < point_count; i++)
-  {
-      if (vertices[i].z)
-      {
-          // upload the point and texture coordinates only for points we have depth data for
-          glVertex3f(vertices[i].x, vertices[i].y, vertices[i].z);
-          glTexCoord2f(tex_coords[i].x, tex_coords[i].y);
-      }
-  }
+}
 
-  // OpenGL cleanup
-  glEnd();
+static void end_orbit_view() {
   glPopMatrix();
   glMatrixMode(GL_PROJECTION);
   glPopMatrix();
@@ -453,9 +514,621 @@ JS_METHOD(drawDepthAndColorAsPointCloud) {
   glPushMatrix();
 }
 
+// GL objects the draw functions keep for each window, since windows do not
+// share contexts. They are released with their window, in its context.
+struct window_objects {
+  ~window_objects();
+
+  // Color textures, created on first use
+  GLuint cloud_texture = 0, mesh_texture = 0, depth_cloud_texture = 0;
+  // drawDepthAndColorAsPointCloud
+  point_cloud cloud;
+  // drawDepthAsPointCloud, deprojecting on the CPU or on the GPU
+  point_cloud depth_cloud;
+  depth_point_cloud gpu_cloud;
+  depth_mesh mesh;
+  // Points of many frames merged on a voxel grid, for scanning
+  point_accumulator accumulator;
+  std::unique_ptr<mosaic> tiles;
+  // draw2x2Streams
+  std::unique_ptr<mosaic> quadrants;
+  // Those of the UploadBuffers made in the window that are still alive
+  std::vector<std::weak_ptr<upload_buffer>> upload_buffers;
+};
+
+window_objects::~window_objects() {
+  for (const std::weak_ptr<upload_buffer>& weak : upload_buffers) {
+    if (std::shared_ptr<upload_buffer> buffer = weak.lock())
+      buffer->release();
+  }
+  for (GLuint texture : { cloud_texture, mesh_texture, depth_cloud_texture }) {
+    if (!texture)
+      continue;
+    forget_frame(texture);
+    forget_texture_storage(texture);
+    forget_depth_texture(texture);
+    forget_yuv_texture(texture);
+    glDeleteTextures(1, &texture);
+  }
+}
+
+typedef std::map<GLFWwindow*, std::unique_ptr<window_objects>> object_map;
+
+// Never destroyed: at exit there may be no context left to release the
+// objects in, and whatever contexts remain go with the process
+static object_map& all_window_objects() {
+  static object_map* objects = new object_map();
+  return *objects;
+}
+
+static window_objects& objects_of(GLFWwindow* win) {
+  std::unique_ptr<window_objects>& objects = all_window_objects()[win];
+  if (!objects)
+    objects.reset(new window_objects());
+  return *objects;
+}
+
+// The objects of the window whose context is current. Throws and returns
+// null without one.
+static window_objects* current_objects() {
+  GLFWwindow* win = glfwGetCurrentContext();
+  if (!win) {
+    ThrowError("No current context");
+    return nullptr;
+  }
+  return &objects_of(win);
+}
+
+static GLuint texture_of(GLuint& texture) {
+  if (!texture)
+    glGenTextures(1, &texture);
+  return texture;
+}
+
+// Release the window's objects and those the modules keep for its context
+static void release_window_objects(GLFWwindow* win) {
+  object_map& all = all_window_objects();
+  auto it = all.find(win);
+  const std::vector<GLFWwindow*> contexts = contexts_with_objects();
+  if (it == all.end() &&
+      std::find(contexts.begin(), contexts.end(), win) == contexts.end())
+    return;
+  GLFWwindow* current = glfwGetCurrentContext();
+  glfwMakeContextCurrent(win);
+  if (it != all.end())
+    all.erase(it);
+  release_context_objects(win);
+  glfwMakeContextCurrent(current == win ? nullptr : current);
+}
+
+static void release_all_window_objects() {
+  while (!all_window_objects().empty())
+    release_window_objects(all_window_objects().begin()->first);
+  for (GLFWwindow* win : contexts_with_objects())
+    release_window_objects(win);
+}
+
+// Draw cloud textured with tex in the orbit view: as sprites when they are
+// on (pixel_angle being the cloud's, if known), otherwise as fixed size
+// points, colorizing raw z16 or YUV textures
+static void draw_point_cloud(const point_cloud& cloud, GLuint tex,
+                             float pixel_angle) {
+  const float spacing = point_decimation_enabled() ?
+      cloud.decimator().voxel_size() : 0;
+  if (begin_point_sprites(pixel_angle, spacing)) {
+    cloud.draw();
+    end_point_sprites();
+    return;
+  }
+  const bool raw_depth = begin_depth_draw(tex);
+  const bool raw_yuv = !raw_depth && begin_yuv_draw(tex);
+  cloud.draw();
+  if (raw_depth)
+    end_depth_draw();
+  if (raw_yuv)
+    end_yuv_draw();
+}
+
+// Vertices of drawDepthAndColorAsPointCloud, while setPointCloudIndexing()
+// asks for them
+static point_index cloud_index;
+static bool index_clouds = false;
+
+JS_METHOD(drawDepthAndColorAsPointCloud) {
+  size_t argIndex = 0;
+  GLFWwindow* win =
+      reinterpret_cast<GLFWwindow*>(Nan::To<int64_t>(info[argIndex++]).FromJust());
+
+  Nan::TypedArrayContents<float> buffer0(info[argIndex++].As<Float32Array>());
+  const float3* vertices = reinterpret_cast<float3*>(*buffer0);
+
+  uint32_t point_count = Nan::To<int32_t>(info[argIndex++]).FromJust();
+
+  Nan::TypedArrayContents<float> buffer1(info[argIndex++].As<Float32Array>());
+  const float2* tex_coords = reinterpret_cast<float2*>(*buffer1);
+
+  Nan::TypedArrayContents<uint8_t> buffer2(info[argIndex++].As<Uint8Array>());
+  uint8_t* color = *buffer2;
+
+  uint32_t color_width = Nan::To<uint32_t>(info[argIndex++]).FromJust();
+  uint32_t color_height = Nan::To<uint32_t>(info[argIndex++]).FromJust();
+  pixel_format color_format = format_arg(info[argIndex++]);
+  frame_layout color_layout = layout_arg(info[argIndex]);
+  double color_frame = frame_arg(info[argIndex++]);
+  if (color && !check_frame(color_format, color_width, color_height,
+                            color_layout, buffer2.length()))
+    return;
+  if (point_count > buffer0.length() / 3 ||
+      point_count > buffer1.length() / 2)
+    return ThrowRangeError("Fewer vertices or texture coordinates than points");
+
+  window_objects& objects = objects_of(win);
+  const GLuint tex = texture_of(objects.cloud_texture);
+
+  // The sprite program replaces any z16 or YUV shader, so with sprites
+  // the color frame has to arrive as RGB
+  const bool sprites = point_sprites_enabled();
+  if (color)
+    upload_texture(tex, color, color_width, color_height, color_format,
+        nullptr, color_layout, color_frame, !sprites);
+  // Only the points that have a depth, paired with their texture coordinates
+  point_cloud& cloud = objects.cloud;
+  cloud.update(&vertices->x, &tex_coords->x, point_count);
+  if (index_clouds)
+    cloud_index.submit(&vertices->x, point_count);
+  begin_orbit_view(win, tex);
+  draw_point_cloud(cloud, tex, 0);
+  end_orbit_view();
+  // How many of the points had a depth and were drawn
+  SET_RETURN_VALUE(JS_INT(int(cloud.size())));
+}
+
+
+// drawDepthAndColorAsMesh(window, vertices, width, height, texCoords, color,
+//     colorWidth, colorHeight, colorFormat[, colorOptions[, maxEdge]])
+// Like drawDepthAndColorAsPointCloud, but draws the width x height vertices
+// as a surface. Triangles with a corner without depth or an edge longer
+// than maxEdge meters (0.05 by default, 0 for no limit) are left out.
+// Returns how many triangles were drawn.
+JS_METHOD(drawDepthAndColorAsMesh) {
+  GLFWwindow* win =
+      reinterpret_cast<GLFWwindow*>(Nan::To<int64_t>(info[0]).FromJust());
+  Nan::TypedArrayContents<float> vertices(info[1]);
+  const uint32_t width = Nan::To<uint32_t>(info[2]).FromJust();
+  const uint32_t height = Nan::To<uint32_t>(info[3]).FromJust();
+  Nan::TypedArrayContents<float> tex_coords(info[4]);
+  Nan::TypedArrayContents<uint8_t> color(info[5]);
+  const uint32_t color_width = Nan::To<uint32_t>(info[6]).FromJust();
+  const uint32_t color_height = Nan::To<uint32_t>(info[7]).FromJust();
+  pixel_format color_format = format_arg(info[8]);
+  frame_layout color_layout = layout_arg(info[9]);
+  double color_frame = frame_arg(info[9]);
+  const double max_edge = info[10]->IsNumber() ?
+      Nan::To<double>(info[10]).FromJust() : 0.05;
+  if (*color && !check_frame(color_format, color_width, color_height,
+                             color_layout, color.length()))
+    return;
+  const size_t points = size_t(width) * height;
+  if (vertices.length() / 3 < points || tex_coords.length() / 2 < points)
+    return ThrowRangeError("Fewer vertices or texture coordinates than pixels");
+  if (!(max_edge >= 0))
+    return ThrowRangeError("Edge length must not be negative");
+
+  window_objects& objects = objects_of(win);
+  const GLuint tex = texture_of(objects.mesh_texture);
+  if (*color)
+    upload_texture(tex, *color, color_width, color_height, color_format,
+        nullptr, color_layout, color_frame);
+
+  depth_mesh& mesh = objects.mesh;
+  mesh.update(*vertices, *tex_coords, width, height, float(max_edge));
+  if (index_clouds)
+    cloud_index.submit(*vertices, points);
+  begin_orbit_view(win, tex);
+  const bool raw_depth = begin_depth_draw(tex);
+  const bool raw_yuv = !raw_depth && begin_yuv_draw(tex);
+  mesh.draw();
+  if (raw_depth)
+    end_depth_draw();
+  if (raw_yuv)
+    end_yuv_draw();
+  end_orbit_view();
+  SET_RETURN_VALUE(JS_NUM(double(mesh.size())));
+}
 
 Nan::Callback* global_js_key_callback = nullptr;
 
+// Intrinsics { width, height, ppx, ppy, fx, fy[, model, coeffs] }, as
+// librealsense reports them. Throws and returns false unless the first six
+// are there.
+static bool intrinsics_arg(Local<Value> value, intrinsics* intrin) {
+  if (!value->IsObject()) {
+    ThrowTypeError("Intrinsics must be an object");
+    return false;
+  }
+  Local<Object> object = value.As<Object>();
+  double fields[6];
+  const char* names[6] = { "width", "height", "ppx", "ppy", "fx", "fy" };
+  for (int i = 0; i < 6; i++) {
+    Local<Value> v =
+        Nan::Get(object, JS_STR(names[i]).ToLocalChecked()).ToLocalChecked();
+    if (!v->IsNumber()) {
+      ThrowTypeError("Intrinsics need width, height, ppx, ppy, fx and fy");
+      return false;
+    }
+    fields[i] = Nan::To<double>(v).FromJust();
+  }
+  intrin->width = int(fields[0]);
+  intrin->height = int(fields[1]);
+  intrin->ppx = float(fields[2]);
+  intrin->ppy = float(fields[3]);
+  intrin->fx = float(fields[4]);
+  intrin->fy = float(fields[5]);
+  if (intrin->width <= 0 || intrin->height <= 0 || !intrin->fx ||
+      !intrin->fy) {
+    ThrowRangeError("Intrinsics need a size and non-zero focal lengths");
+    return false;
+  }
+
+  Local<Value> model =
+      Nan::Get(object, JS_STR("model").ToLocalChecked()).ToLocalChecked();
+  Local<Value> coeffs =
+      Nan::Get(object, JS_STR("coeffs").ToLocalChecked()).ToLocalChecked();
+  intrin->model = model->IsNumber() ?
+      distortion_model(Nan::To<int32_t>(model).FromJust()) : DISTORTION_NONE;
+  if (coeffs->IsObject()) {
+    for (uint32_t i = 0; i < 5; i++) {
+      Local<Value> c = Nan::Get(coeffs.As<Object>(), i).ToLocalChecked();
+      intrin->coeffs[i] = c->IsNumber() ? float(Nan::To<double>(c).FromJust())
+                                        : 0.f;
+    }
+  }
+  return true;
+}
+
+static bool depth_scale_arg(Local<Value> value, float* scale) {
+  *scale = float(Nan::To<double>(value).FromMaybe(0));
+  if (!(*scale > 0) || std::isinf(*scale)) {
+    ThrowRangeError("Depth scale must be a positive number");
+    return false;
+  }
+  return true;
+}
+
+// Extrinsics { rotation: 9 numbers, column major, translation: 3 numbers };
+// either may be left out for no rotation or translation
+static bool extrinsics_arg(Local<Value> value, extrinsics* extrin) {
+  *extrin = extrinsics();
+  if (value->IsUndefined() || value->IsNull())
+    return true;
+  if (!value->IsObject()) {
+    ThrowTypeError("Extrinsics must be an object");
+    return false;
+  }
+  auto numbers = [&](const char* name, float* out, uint32_t n) {
+    Local<Value> v = Nan::Get(value.As<Object>(),
+        JS_STR(name).ToLocalChecked()).ToLocalChecked();
+    if (v->IsUndefined())
+      return true;
+    if (!v->IsArray() && !v->IsFloat32Array() && !v->IsFloat64Array())
+      return false;
+    Local<Object> array = v.As<Object>();
+    for (uint32_t i = 0; i < n; i++) {
+      Local<Value> x = Nan::Get(array, i).ToLocalChecked();
+      if (!x->IsNumber())
+        return false;
+      out[i] = float(Nan::To<double>(x).FromJust());
+    }
+    return true;
+  };
+  if (!numbers("rotation", extrin->rotation, 9) ||
+      !numbers("translation", extrin->translation, 3)) {
+    ThrowTypeError("Extrinsics need 9 rotation and 3 translation numbers");
+    return false;
+  }
+  return true;
+}
+
+// deprojectDepth(depth, depthScale, depthIntrinsics, vertices, texCoords
+//     [, colorIntrinsics[, depthToColor]])
+// Fill vertices (x, y, z) and texCoords (u, v) for every depth pixel, ready
+// for drawDepthAndColorAsPointCloud. Without colorIntrinsics the texture
+// coordinates are into the depth frame itself. Returns how many pixels had
+// a depth.
+JS_METHOD(deprojectDepth) {
+  Nan::TypedArrayContents<uint16_t> depth(info[0]);
+  deprojection d;
+  if (!depth_scale_arg(info[1], &d.depth_scale) ||
+      !intrinsics_arg(info[2], &d.depth))
+    return;
+  Nan::TypedArrayContents<float> vertices(info[3]);
+  Nan::TypedArrayContents<float> tex_coords(info[4]);
+  d.color = d.depth;
+  if (!info[5]->IsUndefined() && !intrinsics_arg(info[5], &d.color))
+    return;
+  if (!extrinsics_arg(info[6], &d.depth_to_color))
+    return;
+
+  const size_t pixels = size_t(d.depth.width) * d.depth.height;
+  if (depth.length() < pixels)
+    return ThrowRangeError("Depth buffer is smaller than the frame");
+  if (vertices.length() < pixels * 3 || tex_coords.length() < pixels * 2)
+    return ThrowRangeError("Vertex or texture coordinate array too small");
+  SET_RETURN_VALUE(JS_NUM(double(
+      deproject_depth(*vertices, *tex_coords, *depth, 0, d))));
+}
+
+// drawDepthAsPointCloud(window, depth, depthIntrinsics, depthScale, color,
+//     colorFormat, colorIntrinsics[, depthToColor[, colorOptions]])
+// Like drawDepthAndColorAsPointCloud, but takes the raw z16 frame and
+// deprojects it on the GPU. depthScale is meters per depth unit; color may
+// be null.
+JS_METHOD(drawDepthAsPointCloud) {
+  GLFWwindow* win =
+      reinterpret_cast<GLFWwindow*>(Nan::To<int64_t>(info[0]).FromJust());
+  Nan::TypedArrayContents<uint16_t> depth(info[1]);
+  deprojection d;
+  intrinsics& depth_intrin = d.depth;
+  intrinsics& color_intrin = d.color;
+  if (!intrinsics_arg(info[2], &depth_intrin) ||
+      !depth_scale_arg(info[3], &d.depth_scale))
+    return;
+  Nan::TypedArrayContents<uint8_t> color(info[4]);
+  pixel_format color_format = format_arg(info[5]);
+  if (!intrinsics_arg(info[6], &color_intrin) ||
+      !extrinsics_arg(info[7], &d.depth_to_color))
+    return;
+  frame_layout color_layout = layout_arg(info[8]);
+  double color_frame = frame_arg(info[8]);
+
+  if (!*depth || depth.length() <
+      size_t(depth_intrin.width) * depth_intrin.height)
+    return ThrowRangeError("Depth buffer is smaller than the frame");
+  if (*color && !check_frame(color_format, color_intrin.width,
+                             color_intrin.height, color_layout,
+                             color.length()))
+    return;
+  // The shader has no lens distortion model; without it, or without
+  // vertex texture fetch, the points are deprojected here. So are points
+  // to be decimated, which needs them in memory, or drawn as sprites.
+  const bool on_gpu = depth_point_cloud::supported() &&
+      !depth_intrin.distorted() && !color_intrin.distorted() &&
+      !point_decimation_enabled() && !point_sprites_enabled();
+
+  window_objects& objects = objects_of(win);
+  const GLuint tex = texture_of(objects.depth_cloud_texture);
+  // The deprojecting program replaces any z16 or YUV shader, so the color
+  // frame has to arrive as RGB
+  if (*color)
+    upload_texture(tex, *color, color_intrin.width, color_intrin.height,
+        color_format, nullptr, color_layout, color_frame,
+        !on_gpu && !point_sprites_enabled());
+
+  depth_point_cloud& gpu_cloud = objects.gpu_cloud;
+  point_cloud& cpu_cloud = objects.depth_cloud;
+  if (on_gpu)
+    gpu_cloud.upload(*depth, depth_intrin);
+  else
+    cpu_cloud.update(*depth, 0, d);
+
+  begin_orbit_view(win, tex);
+  if (on_gpu)
+    gpu_cloud.draw(d.depth_scale, color_intrin, d.depth_to_color);
+  else
+    draw_point_cloud(cpu_cloud, tex, 1 / depth_intrin.fx);
+  end_orbit_view();
+  SET_RETURN_VALUE(Nan::Undefined());
+}
+
+// Each window accumulates a cloud of its own. The functions that take no
+// window act on the one whose context is current.
+
+// setPointCloudAccumulation(voxelSize[, maxMegabytes]): start accumulating
+// anew, into voxels of voxelSize meters taking up to maxMegabytes (256 by
+// default) of memory. The voxels least recently added to make room for new
+// ones beyond that.
+JS_METHOD(setPointCloudAccumulation) {
+  const double voxel_size = Nan::To<double>(info[0]).FromMaybe(0);
+  const double megabytes = info[1]->IsUndefined() ? 256 :
+      Nan::To<double>(info[1]).FromMaybe(0);
+  if (!(voxel_size > 0) || std::isinf(voxel_size))
+    return ThrowRangeError("Voxel size must be a positive number");
+  if (!(megabytes > 0) || megabytes * 1048576 > double(SIZE_MAX))
+    return ThrowRangeError("Memory cap out of range");
+  window_objects* objects = current_objects();
+  if (!objects)
+    return;
+  objects->accumulator.configure(float(voxel_size),
+      size_t(megabytes * 1048576));
+  SET_RETURN_VALUE(Nan::Undefined());
+}
+
+// accumulatePointCloud(vertices, texCoords, pointCount, color, colorWidth,
+//     colorHeight, colorFormat[, colorOptions[, pose]])
+// Merge the points of a frame, given like to drawDepthAndColorAsPointCloud,
+// into the accumulated cloud. pose ({ rotation, translation } as for
+// extrinsics) moves them from the camera into the common frame. color may be
+// null. Returns the number of voxels.
+JS_METHOD(accumulatePointCloud) {
+  Nan::TypedArrayContents<float> vertices(info[0]);
+  Nan::TypedArrayContents<float> tex_coords(info[1]);
+  const uint32_t point_count = Nan::To<uint32_t>(info[2]).FromJust();
+  Nan::TypedArrayContents<uint8_t> color_data(info[3]);
+  color_frame color;
+  color.data = *color_data;
+  color.width = Nan::To<uint32_t>(info[4]).FromJust();
+  color.height = Nan::To<uint32_t>(info[5]).FromJust();
+  color.format = format_arg(info[6]);
+  color.layout = layout_arg(info[7]);
+  extrinsics pose;
+  if (!extrinsics_arg(info[8], &pose))
+    return;
+  if (color.data && !check_frame(color.format, color.width, color.height,
+                                 color.layout, color_data.length()))
+    return;
+  if (point_count > vertices.length() / 3 ||
+      point_count > tex_coords.length() / 2)
+    return ThrowRangeError("Fewer vertices or texture coordinates than points");
+  window_objects* objects = current_objects();
+  if (!objects)
+    return;
+  SET_RETURN_VALUE(JS_NUM(double(objects->accumulator.add(*vertices,
+      *tex_coords, point_count, color, pose))));
+}
+
+// drawAccumulatedPointCloud(window): draw the accumulated cloud with the
+// orbit camera, each voxel in its average color
+JS_METHOD(drawAccumulatedPointCloud) {
+  GLFWwindow* win =
+      reinterpret_cast<GLFWwindow*>(Nan::To<int64_t>(info[0]).FromJust());
+  point_accumulator& accumulator = objects_of(win).accumulator;
+  begin_orbit_view(win, 0);
+  // As sprites, voxels are drawn their own size
+  const bool sprites = begin_point_sprites(-1, accumulator.voxel_size());
+  accumulator.draw();
+  if (sprites)
+    end_point_sprites();
+  end_orbit_view();
+  SET_RETURN_VALUE(Nan::Undefined());
+}
+
+JS_METHOD(clearAccumulatedPointCloud) {
+  window_objects* objects = current_objects();
+  if (!objects)
+    return;
+  objects->accumulator.clear();
+  SET_RETURN_VALUE(Nan::Undefined());
+}
+
+JS_METHOD(getAccumulationStats) {
+  window_objects* objects = current_objects();
+  if (!objects)
+    return;
+  accumulation_stats s = objects->accumulator.stats();
+  Local<Object> stats = Nan::New<Object>();
+  Nan::Set(stats, JS_STR("voxels").ToLocalChecked(), JS_NUM(double(s.voxels)));
+  Nan::Set(stats, JS_STR("blocks").ToLocalChecked(), JS_NUM(double(s.blocks)));
+  Nan::Set(stats, JS_STR("memoryBytes").ToLocalChecked(),
+      JS_NUM(double(s.memory)));
+  Nan::Set(stats, JS_STR("maxMemoryBytes").ToLocalChecked(),
+      JS_NUM(double(s.max_memory)));
+  Nan::Set(stats, JS_STR("evictedBlocks").ToLocalChecked(),
+      JS_NUM(double(s.evicted_blocks)));
+  Nan::Set(stats, JS_STR("uploadedBytes").ToLocalChecked(),
+      JS_NUM(double(s.uploaded_bytes)));
+  SET_RETURN_VALUE(stats);
+}
+
+// setPointCloudIndexing(enable): index the vertices handed to
+// drawDepthAndColorAsPointCloud (or drawDepthAndColorAsMesh) for pickPoint,
+// nearestPoint and pointsInRadius. Indexing runs on a thread of its own, so
+// queries see the last frame indexed, usually the one before the frame on
+// screen.
+JS_METHOD(setPointCloudIndexing) {
+  index_clouds = Nan::To<bool>(info[0]).FromJust();
+  if (!index_clouds)
+    cloud_index.clear();
+  SET_RETURN_VALUE(Nan::Undefined());
+}
+
+// { index, x, y, z, distance }, index being that of the vertex
+static Local<Object> indexed_point_object(const indexed_point& p) {
+  Local<Object> point = Nan::New<Object>();
+  Nan::Set(point, JS_STR("index").ToLocalChecked(), JS_NUM(double(p.index)));
+  Nan::Set(point, JS_STR("x").ToLocalChecked(), JS_NUM(p.x));
+  Nan::Set(point, JS_STR("y").ToLocalChecked(), JS_NUM(p.y));
+  Nan::Set(point, JS_STR("z").ToLocalChecked(), JS_NUM(p.z));
+  Nan::Set(point, JS_STR("distance").ToLocalChecked(), JS_NUM(p.distance));
+  return point;
+}
+
+// A point (x, y, z) from the numbers in info from first on; false (and
+// thrown) unless they are all numbers
+static bool position_arg(const Nan::FunctionCallbackInfo<Value>& info,
+                         int first, float p[3]) {
+  for (int a = 0; a < 3; a++) {
+    if (!info[first + a]->IsNumber()) {
+      ThrowTypeError("Expected x, y and z");
+      return false;
+    }
+    p[a] = float(Nan::To<double>(info[first + a]).FromJust());
+  }
+  return true;
+}
+
+// pickPoint(x, y[, pixelRadius]): the nearest point under window
+// coordinates x, y (as the cursor callbacks report them) as the point cloud
+// was last drawn, within pixelRadius (4 by default) of them. Returns
+// { index, x, y, z, distance } with the distance from the camera, or null.
+JS_METHOD(pickPoint) {
+  const double x = Nan::To<double>(info[0]).FromMaybe(0);
+  const double y = Nan::To<double>(info[1]).FromMaybe(0);
+  const double pixel_radius = info[2]->IsNumber() ?
+      Nan::To<double>(info[2]).FromJust() : 4;
+  const orbit_view& view = last_orbit_view;
+  SET_RETURN_VALUE(Nan::Null());
+  if (!view.width || !view.height)
+    return;
+
+  // The ray through the cursor, from the near to the far plane
+  const GLint viewport[4] = { 0, 0, view.width, view.height };
+  GLdouble near_point[3], far_point[3];
+  if (!gluUnProject(x, view.height - y, 0, view.modelview, view.projection,
+                    viewport, &near_point[0], &near_point[1], &near_point[2]) ||
+      !gluUnProject(x, view.height - y, 1, view.modelview, view.projection,
+                    viewport, &far_point[0], &far_point[1], &far_point[2]))
+    return;
+  float origin[3], direction[3];
+  double length = 0;
+  for (int a = 0; a < 3; a++)
+    length += (far_point[a] - near_point[a]) * (far_point[a] - near_point[a]);
+  length = std::sqrt(length);
+  for (int a = 0; a < 3; a++) {
+    origin[a] = float(near_point[a]);
+    direction[a] = float((far_point[a] - near_point[a]) / length);
+  }
+  // projection[5] is the cotangent of half the vertical field of view
+  const float spread = float(std::max(pixel_radius, 0.5) * 2 /
+      (view.projection[5] * view.height));
+
+  indexed_point found;
+  if (cloud_index.pick(origin, direction, spread, &found))
+    SET_RETURN_VALUE(indexed_point_object(found));
+}
+
+// nearestPoint(x, y, z[, maxDistance]): the indexed point nearest to
+// x, y, z, or null if there is none within maxDistance
+JS_METHOD(nearestPoint) {
+  float p[3];
+  if (!position_arg(info, 0, p))
+    return;
+  const float max_distance = info[3]->IsNumber() ?
+      float(Nan::To<double>(info[3]).FromJust()) : INFINITY;
+  indexed_point found;
+  SET_RETURN_VALUE(Nan::Null());
+  if (cloud_index.nearest(p, max_distance, &found))
+    SET_RETURN_VALUE(indexed_point_object(found));
+}
+
+// pointsInRadius(x, y, z, radius): the vertex indices of the indexed points
+// within radius of x, y, z
+JS_METHOD(pointsInRadius) {
+  float p[3];
+  if (!position_arg(info, 0, p))
+    return;
+  const double radius = Nan::To<double>(info[3]).FromMaybe(-1);
+  if (!(radius >= 0))
+    return ThrowRangeError("Radius must not be negative");
+  std::vector<uint32_t> indices;
+  cloud_index.within(p, float(radius), [&](const indexed_point& q) {
+    indices.push_back(q.index);
+  });
+  Local<Array> array = Nan::New<Array>(uint32_t(indices.size()));
+  for (uint32_t i = 0; i < indices.size(); i++)
+    Nan::Set(array, i, JS_NUM(double(indices[i])));
+  SET_RETURN_VALUE(array);
+}
+
 static void global_key_func(GLFWwindow *, int key,
     int scancode, int action, int mods) {
   if (global_js_key_callback) {
@@ -492,32 +1165,51 @@ JS_METHOD(draw2x2Streams) {
 
   Nan::TypedArrayContents<uint8_t> buffer0(info[argIndex++].As<Uint8Array>());
   const void* data0 = *buffer0;
-  Nan::Utf8String str0(info[argIndex++]);
-  std::string type0 = *str0;
+  pixel_format type0 = format_arg(info[argIndex++]);
   uint32_t width0 = Nan::To<uint32_t>(info[argIndex++]).FromJust();
   uint32_t height0 = Nan::To<uint32_t>(info[argIndex++]).FromJust();
 
   Nan::TypedArrayContents<uint8_t> buffer1(info[argIndex++].As<Uint8Array>());
   const void* data1 = *buffer1;
-  Nan::Utf8String str1(info[argIndex++]);
-  std::string type1 = *str1;
+  pixel_format type1 = format_arg(info[argIndex++]);
   uint32_t width1 = Nan::To<uint32_t>(info[argIndex++]).FromJust();
   uint32_t height1 = Nan::To<uint32_t>(info[argIndex++]).FromJust();
 
   Nan::TypedArrayContents<uint8_t> buffer2(info[argIndex++].As<Uint8Array>());
   const void* data2 = *buffer2;
-  Nan::Utf8String str2(info[argIndex++]);
-  std::string type2 = *str2;
+  pixel_format type2 = format_arg(info[argIndex++]);
   uint32_t width2 = Nan::To<uint32_t>(info[argIndex++]).FromJust();
   uint32_t height2 = Nan::To<uint32_t>(info[argIndex++]).FromJust();
 
   Nan::TypedArrayContents<uint8_t> buffer3(info[argIndex++].As<Uint8Array>());
   const void* data3 = *buffer3;
-  Nan::Utf8String str3(info[argIndex++]);
-  std::string type3 = *str3;
+  pixel_format type3 = format_arg(info[argIndex++]);
   uint32_t width3 = Nan::To<uint32_t>(info[argIndex++]).FromJust();
   uint32_t height3 = Nan::To<uint32_t>(info[argIndex++]).FromJust();
 
+  // Optional array of per-stream frame options
+  frame_layout layouts[4];
+  double frames[4] = { kNoFrame, kNoFrame, kNoFrame, kNoFrame };
+  if (info[argIndex]->IsArray()) {
+    Local<Array> array = info[argIndex].As<Array>();
+    for (uint32_t i = 0; i < 4 && i < array->Length(); i++) {
+      Local<Value> options = Nan::Get(array, i).ToLocalChecked();
+      layouts[i] = layout_arg(options);
+      frames[i] = frame_arg(options);
+    }
+  }
+  argIndex++;
+
+  if ((data0 && !check_frame(type0, width0, height0, layouts[0],
+                             buffer0.length())) ||
+      (data1 && !check_frame(type1, width1, height1, layouts[1],
+                             buffer1.length())) ||
+      (data2 && !check_frame(type2, width2, height2, layouts[2],
+                             buffer2.length())) ||
+      (data3 && !check_frame(type3, width3, height3, layouts[3],
+                             buffer3.length())))
+    return;
+
   glPixelZoom(1, -1);
 
   // X _
@@ -528,45 +1220,225 @@ JS_METHOD(draw2x2Streams) {
   //   auto format = Str2Format(type0);
   //   glDrawPixels(width0, height0, format, GL_UNSIGNED_BYTE, data0);
   // }
-  static GLuint tex = 0;
-  if (!tex)
-    glGenTextures(1, &tex);
 
-  if (data0) {
-    upload_texture(tex, (uint8_t*)data0, width0, height0, type0);
-    Rect rect = { 0, 0, winW/width_divid_factor, winH/height_divid_factor };
-    show(tex, rect.adjust_ratio({float(width0), float(height0)}));
+  // The quadrants are tiles of a mosaic of the window's own, which keeps a
+  // colorizer per tile so that histograms do not interfere. All frames are
+  // uploaded before anything is drawn, and drawn in one call.
+  const float w = winW / width_divid_factor;
+  const float h = winH / height_divid_factor;
+  const void* data[4] = { data0, data1, data2, data3 };
+  const pixel_format types[4] = { type0, type1, type2, type3 };
+  const uint32_t widths[4] = { width0, width1, width2, width3 };
+  const uint32_t heights[4] = { height0, height1, height2, height3 };
+  std::vector<mosaic_stream> streams(4);
+  mosaic_layout layout;
+  for (int i = 0; i < 4; i++) {
+    mosaic_stream& s = streams[i];
+    s.data = static_cast<const uint8_t*>(data[i]);
+    s.format = types[i];
+    s.width = widths[i];
+    s.height = heights[i];
+    s.layout = layouts[i];
+    s.frame = frames[i];
+    // X _    _ X    _ _    _ _
+    // _ _    _ _    X _    _ X
+    layout.rects.push_back({ (i % 2) * w, (i / 2) * h, w, h });
   }
 
-  // _ X
-  // _ _
-  //
-  // Display color image as RGB triples
-  if (data1) {
-    upload_texture(tex, (uint8_t*)data1, width1, height1, type1);
-    Rect rect = { winW/width_divid_factor, 0, winW/width_divid_factor, winH/height_divid_factor };
-    show(tex, rect.adjust_ratio({float(width1), float(height1)}));
+  std::unique_ptr<mosaic>& quadrants = objects_of(win).quadrants;
+  if (!quadrants)
+    quadrants.reset(new mosaic());
+  quadrants->draw(winW, winH, streams, layout);
+  SET_RETURN_VALUE(Nan::Undefined());
+}
+
+static void draw_mosaic(GLFWwindow* win,
+                        const std::vector<mosaic_stream>& streams,
+                        const mosaic_layout& layout) {
+  int32_t winW = 0;
+  int32_t winH = 0;
+  glfwGetWindowSize(win, &winW, &winH);
+  std::unique_ptr<mosaic>& m = objects_of(win).tiles;
+  if (!m)
+    m.reset(new mosaic());
+  m->draw(winW, winH, streams, layout);
+}
+
+static bool number_field(Local<Object> object, const char* name,
+                         float* value) {
+  Local<Value> v =
+      Nan::Get(object, JS_STR(name).ToLocalChecked()).ToLocalChecked();
+  if (!v->IsNumber())
+    return false;
+  *value = float(Nan::To<double>(v).FromJust());
+  return true;
+}
+
+// A mosaic layout argument: { columns, rows }, or an array of { x, y, w, h }
+// window rects, one per stream. Without it the tiles form an about square
+// grid.
+static mosaic_layout mosaic_layout_arg(Local<Value> value) {
+  mosaic_layout layout;
+  if (value->IsArray()) {
+    Local<Array> rects = value.As<Array>();
+    for (uint32_t i = 0; i < rects->Length(); i++) {
+      Local<Value> rect = Nan::Get(rects, i).ToLocalChecked();
+      mosaic_rect r = { 0, 0, 0, 0 };
+      if (rect->IsObject()) {
+        Local<Object> object = rect.As<Object>();
+        number_field(object, "x", &r.x);
+        number_field(object, "y", &r.y);
+        number_field(object, "w", &r.w);
+        number_field(object, "h", &r.h);
+      }
+      layout.rects.push_back(r);
+    }
+  } else if (value->IsObject()) {
+    float columns = 0, rows = 0;
+    number_field(value.As<Object>(), "columns", &columns);
+    number_field(value.As<Object>(), "rows", &rows);
+    layout.columns = unsigned(std::max(columns, 0.f));
+    layout.rows = unsigned(std::max(rows, 0.f));
   }
+  return layout;
+}
 
-  // _ _
-  // X _
-  //
-  // Display infrared image by mapping IR intensity to visible luminance
-  if (data2) {
-    upload_texture(tex, (uint8_t*)data2, width2, height2, type2);
-    Rect rect = { 0, winH/height_divid_factor, winW/width_divid_factor, winH/height_divid_factor};
-    show(tex, rect.adjust_ratio({float(width2), float(height2)}));
+// drawMosaic(window, streams[, layout]): streams is an array of
+// { data, format, width, height } objects, which may also carry the frame
+// options; null entries leave their tile empty.
+JS_METHOD(drawMosaic) {
+  GLFWwindow* win =
+    reinterpret_cast<GLFWwindow*>(Nan::To<int64_t>(info[0]).FromJust());
+  if (!info[1]->IsArray())
+    return ThrowTypeError("Streams must be an array");
+  Local<Array> array = info[1].As<Array>();
+
+  std::vector<mosaic_stream> streams(array->Length());
+  std::vector<std::unique_ptr<Nan::TypedArrayContents<uint8_t>>> buffers;
+  for (uint32_t i = 0; i < array->Length(); i++) {
+    Local<Value> value = Nan::Get(array, i).ToLocalChecked();
+    if (!value->IsObject())
+      continue;
+    Local<Object> object = value.As<Object>();
+    mosaic_stream& s = streams[i];
+    Local<Value> data =
+        Nan::Get(object, JS_STR("data").ToLocalChecked()).ToLocalChecked();
+    if (!data->IsArrayBufferView())
+      continue;
+    buffers.emplace_back(new Nan::TypedArrayContents<uint8_t>(data));
+    s.format = format_arg(
+        Nan::Get(object, JS_STR("format").ToLocalChecked()).ToLocalChecked());
+    s.width = Nan::To<uint32_t>(Nan::Get(object,
+        JS_STR("width").ToLocalChecked()).ToLocalChecked()).FromJust();
+    s.height = Nan::To<uint32_t>(Nan::Get(object,
+        JS_STR("height").ToLocalChecked()).ToLocalChecked()).FromJust();
+    s.layout = layout_arg(object);
+    s.frame = frame_arg(object);
+    if (!check_frame(s.format, s.width, s.height, s.layout,
+                     buffers.back()->length()))
+      return;
+    s.data = **buffers.back();
   }
 
-  // _ _
-  // _ X
-  //
-  // Display second infrared image by mapping IR intensity to visible luminance
-  if (data3) {
-    upload_texture(tex, (uint8_t*)data3, width3, height3, type3);
-    Rect rect = { winW/width_divid_factor, winH/height_divid_factor, winW/width_divid_factor, winH/height_divid_factor};
-    show(tex, rect.adjust_ratio({float(width3), float(height3)}));
+  draw_mosaic(win, streams, mosaic_layout_arg(info[2]));
+  SET_RETURN_VALUE(Nan::Undefined());
+}
+
+// Streams described once, so that frames only have to bring their pixels
+struct registered_stream {
+  bool used = false;
+  pixel_format format = PIXEL_FORMAT_UNKNOWN;
+  uint32_t width = 0, height = 0;
+  frame_layout layout;
+  // Smallest buffer that holds a frame
+  size_t bytes = 0;
+};
+
+// Handles are indices + 1, so that 0 is never a valid handle
+static std::vector<registered_stream> registered_streams;
+
+static registered_stream* stream_arg(Local<Value> value) {
+  const uint32_t handle = Nan::To<uint32_t>(value).FromMaybe(0);
+  if (!handle || handle > registered_streams.size() ||
+      !registered_streams[handle - 1].used)
+    return nullptr;
+  return &registered_streams[handle - 1];
+}
+
+// registerStream(format, width, height[, options]) -> handle. The format,
+// size and frame options (stride, x, y) are checked here, once.
+JS_METHOD(registerStream) {
+  registered_stream s;
+  s.format = format_arg(info[0]);
+  s.width = Nan::To<uint32_t>(info[1]).FromJust();
+  s.height = Nan::To<uint32_t>(info[2]).FromJust();
+  s.layout = layout_arg(info[3]);
+  s.bytes = frame_span(s.format, s.width, s.height, s.layout);
+  if (!check_frame(s.format, s.width, s.height, s.layout, s.bytes))
+    return;
+  if (!s.width || !s.height)
+    return ThrowRangeError("Frame size must not be zero");
+  s.used = true;
+
+  size_t index = 0;
+  while (index < registered_streams.size() && registered_streams[index].used)
+    index++;
+  if (index == registered_streams.size())
+    registered_streams.push_back(s);
+  else
+    registered_streams[index] = s;
+  SET_RETURN_VALUE(JS_INT(int(index + 1)));
+}
+
+JS_METHOD(unregisterStream) {
+  registered_stream* s = stream_arg(info[0]);
+  if (s)
+    *s = registered_stream();
+  SET_RETURN_VALUE(Nan::Undefined());
+}
+
+// submitStreams(window, streams[, layout]): draw the frames as a mosaic
+// into window, in the order given. Each entry of streams is
+// [handle, buffer] or [handle, buffer, frame], frame being the number that
+// lets an unchanged frame skip its upload; null entries leave their tile
+// empty. Buffers only have their size checked.
+JS_METHOD(submitStreams) {
+  GLFWwindow* win =
+    reinterpret_cast<GLFWwindow*>(Nan::To<int64_t>(info[0]).FromJust());
+  if (!info[1]->IsArray())
+    return ThrowTypeError("Streams must be an array");
+  Local<Array> array = info[1].As<Array>();
+
+  std::vector<mosaic_stream> streams(array->Length());
+  std::vector<std::unique_ptr<Nan::TypedArrayContents<uint8_t>>> buffers;
+  for (uint32_t i = 0; i < array->Length(); i++) {
+    Local<Value> value = Nan::Get(array, i).ToLocalChecked();
+    if (value->IsNull() || value->IsUndefined())
+      continue;
+    if (!value->IsArray() || value.As<Array>()->Length() < 2)
+      return ThrowTypeError("Expected [handle, buffer[, frame]] entries");
+    Local<Array> entry = value.As<Array>();
+    const registered_stream* r =
+        stream_arg(Nan::Get(entry, 0).ToLocalChecked());
+    if (!r)
+      return ThrowRangeError("Unknown stream handle");
+    Local<Value> data = Nan::Get(entry, 1).ToLocalChecked();
+    if (!data->IsArrayBufferView())
+      continue;
+    buffers.emplace_back(new Nan::TypedArrayContents<uint8_t>(data));
+    if (buffers.back()->length() < r->bytes)
+      return ThrowRangeError("Buffer is smaller than the frame");
+    Local<Value> frame = Nan::Get(entry, 2).ToLocalChecked();
+    mosaic_stream& s = streams[i];
+    s.data = **buffers.back();
+    s.format = r->format;
+    s.width = r->width;
+    s.height = r->height;
+    s.layout = r->layout;
+    s.frame = frame->IsNumber() ? Nan::To<double>(frame).FromJust() : kNoFrame;
   }
+
+  draw_mosaic(win, streams, mosaic_layout_arg(info[2]));
   SET_RETURN_VALUE(Nan::Undefined());
 }
 
@@ -663,6 +1535,7 @@ JS_METHOD(DestroyWindow) {
   uint64_t handle=Nan::To<int64_t>(info[0]).FromJust();
   if(handle) {
     GLFWwindow* window = reinterpret_cast<GLFWwindow*>(handle);
+    release_window_objects(window);
     glfwDestroyWindow(window);
   }
   SET_RETURN_VALUE(Nan::Undefined());
@@ -930,6 +1803,226 @@ JS_METHOD(ExtensionSupported) {
   SET_RETURN_VALUE(JS_BOOL(glfwExtensionSupported(*str)==1));
 }
 
+/* @Module: depth colorization */
+
+// Build a colormap from (name[, near, far]) arguments starting at first.
+// Returns null and throws if the name is unknown.
+static std::shared_ptr<const colormap> colormap_from_args(
+    const Nan::FunctionCallbackInfo<v8::Value>& info, int first) {
+  Nan::Utf8String name(info[first]);
+  colormap_id id;
+  if (!colormap_from_name(*name, &id)) {
+    ThrowError("Unknown colormap");
+    return nullptr;
+  }
+  uint32_t near_depth = 0, far_depth = 0;
+  if (info[first + 1]->IsNumber() && info[first + 2]->IsNumber()) {
+    near_depth = Nan::To<uint32_t>(info[first + 1]).FromJust();
+    far_depth = Nan::To<uint32_t>(info[first + 2]).FromJust();
+  }
+  return std::make_shared<colormap>(id,
+      uint16_t(std::min(near_depth, 0xFFFFu)),
+      uint16_t(std::min(far_depth, 0xFFFFu)));
+}
+
+// setDepthColorizeOnGpu(enable): upload z16 unchanged and colorize it in a
+// fragment shader where GLSL is available
+JS_METHOD(setDepthColorizeOnGpu) {
+  set_gpu_colorize(Nan::To<bool>(info[0]).FromJust());
+  invalidate_frames();
+  SET_RETURN_VALUE(Nan::Undefined());
+}
+
+// setDepthColormap(name[, near, far]) for every colorizer without its own
+JS_METHOD(setDepthColormap) {
+  std::shared_ptr<const colormap> map = colormap_from_args(info, 0);
+  if (map) {
+    set_default_colormap(map);
+    invalidate_frames();
+  }
+  SET_RETURN_VALUE(Nan::Undefined());
+}
+
+class DepthColorizer : public Nan::ObjectWrap {
+ public:
+  static void Init(Local<Object> target) {
+    Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(New);
+    tpl->SetClassName(JS_STR("DepthColorizer").ToLocalChecked());
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    Nan::SetPrototypeMethod(tpl, "colorize", Colorize);
+    Nan::SetPrototypeMethod(tpl, "setIncremental", SetIncremental);
+    Nan::SetPrototypeMethod(tpl, "setColormap", SetColormap);
+    Nan::SetPrototypeMethod(tpl, "getStats", GetStats);
+    constructor.Reset(tpl);
+    Nan::Set(target, JS_STR("DepthColorizer").ToLocalChecked(),
+        Nan::GetFunction(tpl).ToLocalChecked());
+  }
+
+  // The native colorizer behind value, or null if it is not a DepthColorizer
+  static depth_colorizer* From(Local<Value> value) {
+    if (!value->IsObject() || !Nan::New(constructor)->HasInstance(value))
+      return nullptr;
+    return &Nan::ObjectWrap::Unwrap<DepthColorizer>(value.As<Object>())->colorizer_;
+  }
+
+ private:
+  static JS_METHOD(New) {
+    if (!info.IsConstructCall())
+      return ThrowError("DepthColorizer must be called with new");
+    DepthColorizer* obj = new DepthColorizer();
+    obj->Wrap(info.This());
+    SET_RETURN_VALUE(info.This());
+  }
+
+  // colorize(depth: Uint16Array, width, height[, out: Uint8Array])
+  // Returns out, or a new Buffer when out is not given.
+  static JS_METHOD(Colorize) {
+    DepthColorizer* obj = Nan::ObjectWrap::Unwrap<DepthColorizer>(info.Holder());
+    if (!info[0]->IsUint16Array())
+      return ThrowTypeError("Argument 0 must be a Uint16Array");
+    Nan::TypedArrayContents<uint16_t> depth(info[0]);
+    const uint32_t width = Nan::To<uint32_t>(info[1]).FromJust();
+    const uint32_t height = Nan::To<uint32_t>(info[2]).FromJust();
+    const size_t pixels = size_t(width) * height;
+    if (depth.length() < pixels)
+      return ThrowRangeError("Depth buffer is smaller than width * height");
+
+    if (info.Length() > 3 && info[3]->IsUint8Array()) {
+      Nan::TypedArrayContents<uint8_t> out(info[3]);
+      if (out.length() < pixels * 3)
+        return ThrowRangeError("Output buffer is smaller than width * height * 3");
+      obj->colorizer_.colorize(*out, *depth, width, height);
+      SET_RETURN_VALUE(info[3]);
+      return;
+    }
+    const uint8_t* rgb = obj->colorizer_.colorize(*depth, width, height);
+    SET_RETURN_VALUE(Nan::CopyBuffer(reinterpret_cast<const char*>(rgb),
+        pixels * 3).ToLocalChecked());
+  }
+
+  // setIncremental(interval, threshold = 0.1)
+  static JS_METHOD(SetIncremental) {
+    DepthColorizer* obj = Nan::ObjectWrap::Unwrap<DepthColorizer>(info.Holder());
+    const uint32_t interval = Nan::To<uint32_t>(info[0]).FromJust();
+    const double threshold = info[1]->IsNumber() ?
+        Nan::To<double>(info[1]).FromJust() : 0.1;
+    obj->colorizer_.set_incremental(interval, float(threshold));
+    SET_RETURN_VALUE(Nan::Undefined());
+  }
+
+  // setColormap(name[, near, far]); no name follows setDepthColormap again
+  static JS_METHOD(SetColormap) {
+    DepthColorizer* obj = Nan::ObjectWrap::Unwrap<DepthColorizer>(info.Holder());
+    if (info[0]->IsUndefined() || info[0]->IsNull()) {
+      obj->colorizer_.set_colormap(nullptr);
+    } else {
+      std::shared_ptr<const colormap> map = colormap_from_args(info, 0);
+      if (!map)
+        return;
+      obj->colorizer_.set_colormap(map);
+    }
+    invalidate_frames();
+    SET_RETURN_VALUE(Nan::Undefined());
+  }
+
+  static JS_METHOD(GetStats) {
+    DepthColorizer* obj = Nan::ObjectWrap::Unwrap<DepthColorizer>(info.Holder());
+    Local<Object> stats = Nan::New<Object>();
+    Nan::Set(stats, JS_STR("frames").ToLocalChecked(),
+        JS_NUM(double(obj->colorizer_.frames())));
+    Nan::Set(stats, JS_STR("rebuilds").ToLocalChecked(),
+        JS_NUM(double(obj->colorizer_.rebuilds())));
+    SET_RETURN_VALUE(stats);
+  }
+
+  static Nan::Persistent<FunctionTemplate> constructor;
+  depth_colorizer colorizer_;
+};
+
+Nan::Persistent<FunctionTemplate> DepthColorizer::constructor;
+
+// new UploadBuffer(bytes): memory to write frames into and upload from
+// through a pixel buffer of its own. Pass .data, or a view into it, to
+// uploadAsTexture. .persistent tells whether uploads are staged through a
+// persistently mapped buffer. The pixel buffer belongs to the current
+// context's window; once that is destroyed, uploads from .data go on
+// without it.
+class UploadBuffer : public Nan::ObjectWrap {
+ public:
+  static void Init(Local<Object> target) {
+    Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(New);
+    tpl->SetClassName(JS_STR("UploadBuffer").ToLocalChecked());
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    Nan::SetPrototypeMethod(tpl, "wait", Wait);
+    Nan::Set(target, JS_STR("UploadBuffer").ToLocalChecked(),
+        Nan::GetFunction(tpl).ToLocalChecked());
+  }
+
+ private:
+  // Whichever of the object and .data goes last (garbage collected, with
+  // any context current) deletes the buffer in its window's context. If the
+  // window is gone, its GL objects were released with it; .data is native
+  // memory and outlives them.
+  struct in_window_deleter {
+    GLFWwindow* window;
+    void operator()(upload_buffer* buffer) const {
+      GLFWwindow* current = glfwGetCurrentContext();
+      const bool other = buffer->has_buffer() && current != window;
+      if (other)
+        glfwMakeContextCurrent(window);
+      delete buffer;
+      if (other)
+        glfwMakeContextCurrent(current);
+    }
+  };
+
+  UploadBuffer(size_t bytes, GLFWwindow* window)
+      : buffer_(new upload_buffer(bytes), in_window_deleter{ window }) {
+    std::vector<std::weak_ptr<upload_buffer>>& buffers =
+        objects_of(window).upload_buffers;
+    buffers.erase(std::remove_if(buffers.begin(), buffers.end(),
+        [](const std::weak_ptr<upload_buffer>& b) { return b.expired(); }),
+        buffers.end());
+    buffers.push_back(buffer_);
+  }
+
+  static JS_METHOD(New) {
+    if (!info.IsConstructCall())
+      return ThrowError("UploadBuffer must be called with new");
+    double bytes = Nan::To<double>(info[0]).FromJust();
+    if (!(bytes >= 1 && bytes <= double(node::Buffer::kMaxLength)))
+      return ThrowRangeError("Invalid UploadBuffer size");
+    GLFWwindow* window = glfwGetCurrentContext();
+    if (!window)
+      return ThrowError("UploadBuffer needs a current context");
+    UploadBuffer* obj = new UploadBuffer(size_t(bytes), window);
+    obj->Wrap(info.This());
+
+    // The GL buffer lives as long as either this object or .data does
+    upload_buffer* buffer = obj->buffer_.get();
+    Local<Object> data = Nan::NewBuffer(
+        reinterpret_cast<char*>(buffer->data()), buffer->size(), Release,
+        new std::shared_ptr<upload_buffer>(obj->buffer_)).ToLocalChecked();
+    Nan::Set(info.This(), JS_STR("data").ToLocalChecked(), data);
+    Nan::Set(info.This(), JS_STR("persistent").ToLocalChecked(),
+        JS_BOOL(buffer->persistent()));
+    SET_RETURN_VALUE(info.This());
+  }
+
+  static void Release(char*, void* hint) {
+    delete static_cast<std::shared_ptr<upload_buffer>*>(hint);
+  }
+
+  // wait(): block until the last upload from the buffer has been read.
+  // Returns the milliseconds spent waiting.
+  static JS_METHOD(Wait) {
+    UploadBuffer* obj = Nan::ObjectWrap::Unwrap<UploadBuffer>(info.Holder());
+    SET_RETURN_VALUE(JS_NUM(obj->buffer_->wait()));
+  }
+
+  std::shared_ptr<upload_buffer> buffer_;
+};
+
 JS_METHOD(uploadAsTexture) {
   size_t argIndex = 0;
   GLuint tex =
@@ -939,11 +2032,16 @@ JS_METHOD(uploadAsTexture) {
 
   uint32_t width = Nan::To<uint32_t>(info[argIndex++]).FromJust();
   uint32_t height = Nan::To<uint32_t>(info[argIndex++]).FromJust();
-  Nan::Utf8String str0(info[argIndex++]);
-  std::string format_str = *str0;
+  pixel_format format = format_arg(info[argIndex++]);
+  depth_colorizer* colorizer = DepthColorizer::From(info[argIndex++]);
+  frame_layout layout = layout_arg(info[argIndex]);
+  double frame = frame_arg(info[argIndex++]);
+  if (buffer && !check_frame(format, width, height, layout, buffer0.length()))
+    return;
 
   if (buffer)
-    upload_texture(tex, buffer, width, height, format_str);
+    upload_texture(tex, buffer, width, height, format, colorizer, layout,
+        frame);
   SET_RETURN_VALUE(Nan::Undefined());
 }
 
@@ -965,6 +2063,95 @@ JS_METHOD(genTexture) {
   SET_RETURN_VALUE(JS_NUM(tex));
 }
 
+// setWorkerPoolSize(threads): threads to split per-frame work across,
+// including the calling one; 0 for one per core. Returns the size in effect.
+JS_METHOD(setWorkerPoolSize) {
+  const double threads = Nan::To<double>(info[0]).FromMaybe(-1);
+  if (!(threads >= 0 && threads <= worker_pool::max_size()) ||
+      threads != std::floor(threads))
+    return ThrowRangeError("Thread count must be an integer from 0 to four "
+                           "per core");
+  worker_pool::instance().resize(unsigned(threads));
+  SET_RETURN_VALUE(JS_INT(worker_pool::instance().size()));
+}
+
+JS_METHOD(getWorkerPoolSize) {
+  SET_RETURN_VALUE(JS_INT(worker_pool::instance().size()));
+}
+
+// setTextureStreaming(ringDepth): upload frames through ringDepth fenced
+// pixel buffers per texture (2 or 3 is plenty), 0 to upload directly.
+// Returns the depth in effect, 0 where the context cannot stream.
+JS_METHOD(setTextureStreaming) {
+  set_texture_streaming(Nan::To<uint32_t>(info[0]).FromJust());
+  SET_RETURN_VALUE(JS_INT(texture_streaming()));
+}
+
+// setPointSprites(options): draw point clouds as sprites sized by depth, with
+// options { scale = 1, circular = false, pixelAngle = 1 / 600 }, pixelAngle
+// being the angle between depth pixels (1 / fx) of clouds drawn from
+// vertices. false turns them off.
+JS_METHOD(setPointSprites) {
+  point_sprite_settings s;
+  s.enabled = info[0]->IsObject() || Nan::To<bool>(info[0]).FromJust();
+  if (info[0]->IsObject()) {
+    Local<Object> options = info[0].As<Object>();
+    Local<Value> scale =
+        Nan::Get(options, JS_STR("scale").ToLocalChecked()).ToLocalChecked();
+    Local<Value> circular = Nan::Get(options,
+        JS_STR("circular").ToLocalChecked()).ToLocalChecked();
+    Local<Value> angle = Nan::Get(options,
+        JS_STR("pixelAngle").ToLocalChecked()).ToLocalChecked();
+    if (scale->IsNumber())
+      s.scale = float(Nan::To<double>(scale).FromJust());
+    if (angle->IsNumber())
+      s.pixel_angle = float(Nan::To<double>(angle).FromJust());
+    s.circular = Nan::To<bool>(circular).FromJust();
+    if (!(s.scale > 0) || !(s.pixel_angle > 0))
+      return ThrowRangeError("Sprite scale and pixel angle must be positive");
+  }
+  set_point_sprites(s);
+  // Color frames are uploaded as RGB while sprites are on
+  invalidate_frames();
+  SET_RETURN_VALUE(Nan::Undefined());
+}
+
+// setPointCloudDecimation(voxelSize[, pointBudget]): draw one point per
+// voxelSize meter cube, and no more than pointBudget points (the voxels grow
+// over the next frames to fit it). 0 turns either off.
+JS_METHOD(setPointCloudDecimation) {
+  const double voxel_size = Nan::To<double>(info[0]).FromMaybe(0);
+  const double budget = info[1]->IsUndefined() ? 0 :
+      Nan::To<double>(info[1]).FromMaybe(0);
+  if (!(voxel_size >= 0) || std::isinf(voxel_size) || !(budget >= 0))
+    return ThrowRangeError("Voxel size and point budget must not be negative");
+  set_point_decimation(float(voxel_size),
+      std::isinf(budget) ? 0 : size_t(budget));
+  SET_RETURN_VALUE(Nan::Undefined());
+}
+
+JS_METHOD(getFrameCacheStats) {
+  frame_cache_stats s = frame_cache_statistics();
+  Local<Object> stats = Nan::New<Object>();
+  Nan::Set(stats, JS_STR("hits").ToLocalChecked(), JS_NUM(double(s.hits)));
+  Nan::Set(stats, JS_STR("misses").ToLocalChecked(),
+      JS_NUM(double(s.misses)));
+  SET_RETURN_VALUE(stats);
+}
+
+JS_METHOD(getTextureStreamingStats) {
+  streaming_stats s = texture_streaming_stats();
+  Local<Object> stats = Nan::New<Object>();
+  Nan::Set(stats, JS_STR("ringDepth").ToLocalChecked(), JS_INT(s.ring_depth));
+  Nan::Set(stats, JS_STR("uploads").ToLocalChecked(),
+      JS_NUM(double(s.uploads)));
+  Nan::Set(stats, JS_STR("fenceWaits").ToLocalChecked(),
+      JS_NUM(double(s.fence_waits)));
+  Nan::Set(stats, JS_STR("fenceWaitMs").ToLocalChecked(),
+      JS_NUM(s.fence_wait_ms));
+  SET_RETURN_VALUE(stats);
+}
+
 // make sure we close everything when we exit
 void AtExit() {
   glfwTerminate();
@@ -978,6 +2165,7 @@ void AtExit() {
 //
 ///////////////////////////////////////////////////////////////////////////////
 #define JS_GLFW_CONSTANT(name) Nan::Set(target, JS_STR( #name ).ToLocalChecked(), JS_INT(GLFW_ ## name))
+#define JS_FORMAT_CONSTANT(name) Nan::Set(target, JS_STR( "FORMAT_" #name ).ToLocalChecked(), JS_INT(glfw::PIXEL_FORMAT_ ## name))
 #define JS_GLFW_SET_METHOD(name) Nan::SetMethod(target, #name , glfw::name);
 
 extern "C" {
@@ -1320,11 +2508,50 @@ void init(Local<Object> target) {
   JS_GLFW_SET_METHOD(testScene);
   JS_GLFW_SET_METHOD(drawImage2D);
   JS_GLFW_SET_METHOD(draw2x2Streams);
+  JS_GLFW_SET_METHOD(drawMosaic);
+  JS_GLFW_SET_METHOD(registerStream);
+  JS_GLFW_SET_METHOD(unregisterStream);
+  JS_GLFW_SET_METHOD(submitStreams);
   JS_GLFW_SET_METHOD(drawDepthAndColorAsPointCloud);
+  JS_GLFW_SET_METHOD(drawDepthAsPointCloud);
+  JS_GLFW_SET_METHOD(drawDepthAndColorAsMesh);
+  JS_GLFW_SET_METHOD(deprojectDepth);
+  JS_GLFW_SET_METHOD(setPointCloudAccumulation);
+  JS_GLFW_SET_METHOD(accumulatePointCloud);
+  JS_GLFW_SET_METHOD(drawAccumulatedPointCloud);
+  JS_GLFW_SET_METHOD(clearAccumulatedPointCloud);
+  JS_GLFW_SET_METHOD(getAccumulationStats);
+  JS_GLFW_SET_METHOD(setPointCloudIndexing);
+  JS_GLFW_SET_METHOD(pickPoint);
+  JS_GLFW_SET_METHOD(nearestPoint);
+  JS_GLFW_SET_METHOD(pointsInRadius);
   JS_GLFW_SET_METHOD(setKeyCallback);
   JS_GLFW_SET_METHOD(uploadAsTexture);
   JS_GLFW_SET_METHOD(showInRect);
   JS_GLFW_SET_METHOD(genTexture);
+  JS_GLFW_SET_METHOD(setWorkerPoolSize);
+  JS_GLFW_SET_METHOD(getWorkerPoolSize);
+  JS_GLFW_SET_METHOD(setTextureStreaming);
+  JS_GLFW_SET_METHOD(getTextureStreamingStats);
+  JS_GLFW_SET_METHOD(getFrameCacheStats);
+  JS_GLFW_SET_METHOD(setPointCloudDecimation);
+  JS_GLFW_SET_METHOD(setPointSprites);
+  JS_GLFW_SET_METHOD(setDepthColormap);
+  JS_GLFW_SET_METHOD(setDepthColorizeOnGpu);
+
+  /* Pixel formats */
+  JS_FORMAT_CONSTANT(Z16);
+  JS_FORMAT_CONSTANT(RGB8);
+  JS_FORMAT_CONSTANT(Y8);
+  JS_FORMAT_CONSTANT(RAW8);
+  JS_FORMAT_CONSTANT(Y16);
+  JS_FORMAT_CONSTANT(YUYV);
+  JS_FORMAT_CONSTANT(UYVY);
+  JS_FORMAT_CONSTANT(NV12);
+  JS_FORMAT_CONSTANT(I420);
+
+  glfw::DepthColorizer::Init(target);
+  glfw::UploadBuffer::Init(target);
 }
 
 NODE_MODULE(glfw, init)
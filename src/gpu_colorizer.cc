@@ -0,0 +1,180 @@
+/*
+ * gpu_colorizer.cc
+ *
+ * z16 frames are uploaded unchanged as GL_LUMINANCE16 (2 bytes per pixel
+ * instead of 3) and looked up in the 64K-entry depth to color table in a
+ * fragment shader. The table lives in a 256x256 RGBA texture, indexed by the
+ * low and high byte of the depth, since a 65536 texel wide 1D texture is
+ * beyond GL_MAX_TEXTURE_SIZE on many drivers (16384 on llvmpipe).
+ */
+
+#include "gpu_colorizer.h"
+#include "texture_upload.h"
+
+#include <map>
+#include <memory>
+
+namespace glfw {
+
+namespace {
+
+const char* kDepthFragmentShader =
+    "#version 110\n"
+    "uniform sampler2D depth_tex;\n"
+    "uniform sampler2D lut_tex;\n"
+    "void main() {\n"
+    "  float d = floor(texture2D(depth_tex, gl_TexCoord[0].st).r * 65535.0 + 0.5);\n"
+    "  vec2 at = (vec2(mod(d, 256.0), floor(d / 256.0)) + 0.5) / 256.0;\n"
+    "  gl_FragColor = vec4(texture2D(lut_tex, at).rgb, 1.0) * gl_Color;\n"
+    "}\n";
+
+struct depth_texture {
+  GLuint lut_texture = 0;
+  // What the table texture currently holds
+  const uint32_t* table = nullptr;
+  const depth_colorizer* source = nullptr;
+  unsigned long version = 0;
+  std::shared_ptr<const colormap> map;
+};
+
+// The program and the table textures of the depth textures of a context
+struct depth_objects {
+  ~depth_objects();
+
+  GLuint program = 0;
+  bool tried = false;
+  std::map<GLuint, depth_texture> textures;
+};
+
+depth_objects::~depth_objects() {
+  for (auto& t : textures)
+    glDeleteTextures(1, &t.second.lut_texture);
+  if (program)
+    glDeleteProgram(program);
+}
+
+bool enabled = false;
+per_context<depth_objects> objects;
+
+std::map<GLuint, depth_texture>& textures() {
+  return objects.current().textures;
+}
+
+GLuint depth_program() {
+  depth_objects& o = objects.current();
+  if (!o.tried) {
+    o.tried = true;
+    o.program = compile_program(nullptr, kDepthFragmentShader);
+    if (o.program) {
+      glUseProgram(o.program);
+      glUniform1i(glGetUniformLocation(o.program, "depth_tex"), 0);
+      glUniform1i(glGetUniformLocation(o.program, "lut_tex"), 1);
+      glUseProgram(0);
+    }
+  }
+  return o.program;
+}
+
+void set_nearest(GLenum target) {
+  glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void update_table(depth_texture& t, const uint32_t* table,
+                  const depth_colorizer& colorizer) {
+  bool full = false;
+  if (!t.lut_texture) {
+    glGenTextures(1, &t.lut_texture);
+    glBindTexture(GL_TEXTURE_2D, t.lut_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, 256, 0,
+        GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    set_nearest(GL_TEXTURE_2D);
+    full = true;
+  } else if (t.table == table && t.source == &colorizer &&
+             t.version == colorizer.rebuilds() &&
+             t.map == colorizer.active_colormap()) {
+    return;
+  } else {
+    glBindTexture(GL_TEXTURE_2D, t.lut_texture);
+  }
+
+  // Only rows holding depths of this frame have to be current
+  depth_range r = colorizer.lut_range();
+  int first = 0, last = 255;
+  if (!full) {
+    if (r.empty()) r = { 0, 0 };
+    first = r.lo >> 8;
+    last = r.hi >> 8;
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, 256, last - first + 1,
+      GL_RGBA, GL_UNSIGNED_BYTE, table + first * 256);
+
+  t.table = table;
+  t.source = &colorizer;
+  t.version = colorizer.rebuilds();
+  t.map = colorizer.active_colormap();
+}
+
+} // namespace
+
+void set_gpu_colorize(bool enable) {
+  enabled = enable;
+}
+
+bool gpu_colorize_enabled() {
+  return enabled && shaders_supported() && depth_program();
+}
+
+void upload_depth_texture(GLuint texture, const uint16_t* depth,
+                          int width, int height, const frame_layout& layout,
+                          depth_colorizer& colorizer) {
+  depth_texture& t = textures()[texture];
+  const int stride = layout.stride ? int(layout.stride / 2) : width;
+  const uint32_t* table = colorizer.build_lut(
+      depth + size_t(layout.y) * stride + layout.x, width, height, stride);
+  update_table(t, table, colorizer);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+  {
+    unpack_layout unpack(layout, 2);
+    upload_texture_image(texture, GL_LUMINANCE16, width, height,
+        GL_LUMINANCE, GL_UNSIGNED_SHORT, depth);
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  // Interpolated depths would pick colors of depths that are not there
+  set_nearest(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void forget_depth_texture(GLuint texture) {
+  std::map<GLuint, depth_texture>& all = textures();
+  auto it = all.find(texture);
+  if (it == all.end())
+    return;
+  glDeleteTextures(1, &it->second.lut_texture);
+  all.erase(it);
+}
+
+bool begin_depth_draw(GLuint texture) {
+  std::map<GLuint, depth_texture>& all = textures();
+  auto it = all.find(texture);
+  if (it == all.end())
+    return false;
+  glUseProgram(depth_program());
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, it->second.lut_texture);
+  glActiveTexture(GL_TEXTURE0);
+  return true;
+}
+
+void end_depth_draw() {
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glUseProgram(0);
+}
+
+} // namespace glfw
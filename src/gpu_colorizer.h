@@ -0,0 +1,37 @@
+/*
+ * gpu_colorizer.h
+ *
+ */
+
+#ifndef GPU_COLORIZER_H_
+#define GPU_COLORIZER_H_
+
+#include "shader.h"
+#include "depth_colorizer.h"
+#include "pixel_format.h"
+
+namespace glfw {
+
+// Keep z16 uploads as raw 16-bit depth and colorize them in a fragment
+// shader. Only takes effect where the context supports GLSL.
+void set_gpu_colorize(bool enable);
+bool gpu_colorize_enabled();
+
+// Upload a z16 frame unchanged into texture and refresh the texture's color
+// table from colorizer, which runs without its CPU colorize pass.
+void upload_depth_texture(GLuint texture, const uint16_t* depth,
+                          int width, int height, const frame_layout& layout,
+                          depth_colorizer& colorizer);
+
+// texture no longer holds raw depth (it was re-uploaded with color data)
+void forget_depth_texture(GLuint texture);
+
+// If texture holds raw depth, bind the colorizing program and its table so
+// that drawing with texture bound on unit 0 yields colors. Returns false,
+// and binds nothing, for ordinary textures.
+bool begin_depth_draw(GLuint texture);
+void end_depth_draw();
+
+} // namespace glfw
+
+#endif /* GPU_COLORIZER_H_ */
@@ -0,0 +1,530 @@
+/*
+ * mosaic.cc
+ *
+ * Tiles share atlas textures (RGBA8, shelf packed) so that drawing them
+ * needs neither texture nor program switches. Frames go into the atlas in
+ * the form they arrive in and one fragment shader decodes each tile as its
+ * vertices say: z16 as two bytes looked up in the tile's rows of a shared
+ * table texture, as gpu_colorizer does for a single frame; packed YUV as
+ * one texel per pair of pixels and planar YUV as luma with the chroma
+ * planes below it, converted as in yuv.cc. Pages holding such tiles are
+ * sampled nearest, since neither bytes nor pixel pairs may be blended.
+ *
+ * Tiles keep the size of their frames in the atlas and are scaled when
+ * drawn; on filtered pages texture coordinates stop half a texel inside
+ * each tile so that filtering never reaches into a neighbour.
+ */
+
+#include "mosaic.h"
+#include "gpu_colorizer.h"
+#include "texture_upload.h"
+#include "yuv.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace glfw {
+
+namespace {
+
+// Largest atlas page, also where GL_MAX_TEXTURE_SIZE is higher
+const GLint kMaxPageSize = 8192;
+
+// x, y, s, t, then for the shader the offsets that take the tile's luma
+// coordinates to its U and from U to V, and the decode mode and table row
+const int kVertexFloats = 10;
+const int kTileVertices = 6;
+
+const char* kMosaicFragmentShader =
+    "#version 110\n"
+    "uniform sampler2D atlas_tex;\n"
+    "uniform sampler2D lut_tex;\n"
+    "uniform vec2 page_size;\n"
+    "uniform vec2 lut_size;\n"
+    "vec3 to_rgb(vec3 yuv) {\n"
+    "  yuv = yuv * 255.0 - vec3(16.0, 128.0, 128.0);\n"
+    "  return vec3(75.0 * yuv.x + 102.0 * yuv.z,\n"
+    "              75.0 * yuv.x - 25.0 * yuv.y - 52.0 * yuv.z,\n"
+    "              75.0 * yuv.x + 129.0 * yuv.y) / (64.0 * 255.0);\n"
+    "}\n"
+    "void main() {\n"
+    "  vec2 st = gl_TexCoord[0].st;\n"
+    "  vec4 chroma = gl_TexCoord[1];\n"
+    "  float mode = floor(gl_TexCoord[2].s + 0.5);\n"
+    "  vec4 t = texture2D(atlas_tex, st);\n"
+    "  vec4 color = t;\n"
+    "  if (mode == 1.0) {\n"
+    "    float d = floor(t.r * 255.0 + 0.5) + floor(t.a * 255.0 + 0.5) * 256.0;\n"
+    "    vec2 at = vec2(mod(d, 256.0), gl_TexCoord[2].t + floor(d / 256.0));\n"
+    "    color = vec4(texture2D(lut_tex, (at + 0.5) / lut_size).rgb, 1.0);\n"
+    "  } else if (mode == 2.0 || mode == 3.0) {\n"
+    "    float odd = step(0.5, fract(st.s * page_size.x));\n"
+    "    vec3 yuv = mode == 2.0 ? vec3(mix(t.r, t.b, odd), t.g, t.a)\n"
+    "                           : vec3(mix(t.g, t.a, odd), t.r, t.b);\n"
+    "    color = vec4(to_rgb(yuv), 1.0);\n"
+    "  } else if (mode == 4.0) {\n"
+    "    vec4 c = texture2D(atlas_tex, st * 0.5 + chroma.st);\n"
+    "    color = vec4(to_rgb(vec3(t.r, c.r, c.a)), 1.0);\n"
+    "  } else if (mode == 5.0) {\n"
+    "    vec2 u = st * 0.5 + chroma.st;\n"
+    "    color = vec4(to_rgb(vec3(t.r, texture2D(atlas_tex, u).r,\n"
+    "        texture2D(atlas_tex, u + chroma.pq).r)), 1.0);\n"
+    "  }\n"
+    "  gl_FragColor = color * gl_Color;\n"
+    "}\n";
+
+// The largest rect of the frame's aspect ratio centered in cell
+mosaic_rect fit(const mosaic_rect& cell, uint32_t width, uint32_t height) {
+  if (!width || !height)
+    return { cell.x, cell.y, 0, 0 };
+  float w = cell.h * width / height, h = cell.h;
+  if (w > cell.w) {
+    h *= cell.w / w;
+    w = cell.w;
+  }
+  return { cell.x + (cell.w - w) / 2, cell.y + (cell.h - h) / 2, w, h };
+}
+
+std::vector<mosaic_rect> tile_rects(int window_width, int window_height,
+                                    const mosaic_layout& layout, size_t n) {
+  std::vector<mosaic_rect> cells(n, mosaic_rect{ 0, 0, 0, 0 });
+  if (!layout.rects.empty()) {
+    std::copy_n(layout.rects.begin(), std::min(n, layout.rects.size()),
+        cells.begin());
+    return cells;
+  }
+  unsigned columns = layout.columns, rows = layout.rows;
+  if (!columns && !rows)
+    columns = unsigned(std::ceil(std::sqrt(double(n))));
+  if (!columns)
+    columns = unsigned((n + rows - 1) / rows);
+  if (!rows)
+    rows = unsigned((n + columns - 1) / columns);
+  if (!columns || !rows)
+    return cells;
+  const float w = float(window_width) / columns;
+  const float h = float(window_height) / rows;
+  for (size_t i = 0; i < n && i < size_t(columns) * rows; i++)
+    cells[i] = { (i % columns) * w, (i / columns) * h, w, h };
+  return cells;
+}
+
+bool same_rect(const mosaic_rect& a, const mosaic_rect& b) {
+  return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h;
+}
+
+void set_filter(GLenum filter) {
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+} // namespace
+
+mosaic::~mosaic() {
+  for (GLuint page : pages_)
+    forget_frame(page);
+  if (!pages_.empty())
+    glDeleteTextures(GLsizei(pages_.size()), pages_.data());
+  if (lut_)
+    glDeleteTextures(1, &lut_);
+  if (vbo_)
+    glDeleteBuffers(1, &vbo_);
+  if (program_)
+    glDeleteProgram(program_);
+}
+
+mosaic::decode mosaic::decode_for(const mosaic_stream& stream) const {
+  if (!program_ || !stream.data)
+    return DECODE_NONE;
+  switch (stream.format) {
+    case PIXEL_FORMAT_Z16:
+      return gpu_colorize_enabled() ? DECODE_Z16 : DECODE_NONE;
+    // Rows are handed to GL in whole texels
+    case PIXEL_FORMAT_YUYV:
+      return stream.layout.stride % 4 ? DECODE_NONE : DECODE_YUYV;
+    case PIXEL_FORMAT_UYVY:
+      return stream.layout.stride % 4 ? DECODE_NONE : DECODE_UYVY;
+    case PIXEL_FORMAT_NV12:
+      return DECODE_NV12;
+    case PIXEL_FORMAT_I420:
+      return DECODE_I420;
+    default:
+      return DECODE_NONE;
+  }
+}
+
+bool mosaic::same_streams(int window_width, int window_height,
+                          const std::vector<mosaic_stream>& streams,
+                          const mosaic_layout& layout) const {
+  if (window_width != window_width_ || window_height != window_height_ ||
+      streams.size() != tiles_.size() ||
+      layout.columns != layout_.columns || layout.rows != layout_.rows ||
+      layout.rects.size() != layout_.rects.size())
+    return false;
+  for (size_t i = 0; i < layout.rects.size(); i++) {
+    if (!same_rect(layout.rects[i], layout_.rects[i]))
+      return false;
+  }
+  for (size_t i = 0; i < streams.size(); i++) {
+    const mosaic_stream& s = streams[i];
+    const tile& t = tiles_[i];
+    if (s.format != t.format || (s.data ? s.width : 0) != t.width ||
+        (s.data ? s.height : 0) != t.height)
+      return false;
+    // A table row may have been given up for lack of room
+    const decode mode = decode_for(s);
+    if (mode != t.mode && !(mode == DECODE_Z16 && t.lut_row < 0))
+      return false;
+  }
+  return true;
+}
+
+void mosaic::pack() {
+  GLint max_size = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+  max_size = std::min(max_size, kMaxPageSize);
+
+  // Rows of the table texture, 256 per z16 tile while they fit; the others
+  // are colorized on the CPU
+  lut_rows_ = 0;
+  for (tile& t : tiles_) {
+    t.lut_row = -1;
+    if (t.mode != DECODE_Z16)
+      continue;
+    if (lut_rows_ + 256 > max_size) {
+      t.mode = DECODE_NONE;
+      continue;
+    }
+    t.lut_row = lut_rows_;
+    t.table = nullptr;
+    lut_rows_ += 256;
+  }
+
+  double area = 0;
+  GLint widest = 0;
+  for (tile& t : tiles_) {
+    t.region_width = int(t.width);
+    t.region_height = int(t.height);
+    if (t.mode == DECODE_YUYV || t.mode == DECODE_UYVY)
+      t.region_width /= 2;
+    else if (t.mode == DECODE_NV12 || t.mode == DECODE_I420)
+      t.region_height += t.region_height / 2;
+    area += double(t.region_width) * t.region_height;
+    widest = std::max(widest, GLint(t.region_width));
+  }
+  // Shelves about as wide as a square holding every tile would be
+  const GLint limit = std::min(max_size,
+      std::max(widest, GLint(std::ceil(std::sqrt(area)))));
+
+  page_width_.clear();
+  page_height_.clear();
+  page_linear_.clear();
+  int page = -1, x = 0, y = 0, shelf = 0;
+  for (tile& t : tiles_) {
+    t.page = -1;
+    if (!t.width || !t.height || t.region_width > max_size ||
+        t.region_height > max_size)
+      continue;
+    if (page >= 0 && x + t.region_width > limit) {
+      x = 0;
+      y += shelf;
+      shelf = 0;
+    }
+    if (page < 0 || y + t.region_height > max_size) {
+      page++;
+      page_width_.push_back(0);
+      page_height_.push_back(0);
+      page_linear_.push_back(true);
+      x = y = shelf = 0;
+    }
+    t.page = page;
+    t.x = x;
+    t.y = y;
+    x += t.region_width;
+    shelf = std::max(shelf, t.region_height);
+    page_width_[page] = std::max(page_width_[page], x);
+    page_height_[page] = std::max(page_height_[page], y + t.region_height);
+    if (t.mode != DECODE_NONE)
+      page_linear_[page] = false;
+  }
+
+  // New pages start out without any frame in them
+  for (GLuint texture : pages_)
+    forget_frame(texture);
+  if (!pages_.empty())
+    glDeleteTextures(GLsizei(pages_.size()), pages_.data());
+  pages_.assign(page_width_.size(), 0);
+  if (!pages_.empty())
+    glGenTextures(GLsizei(pages_.size()), pages_.data());
+  for (size_t i = 0; i < pages_.size(); i++) {
+    glBindTexture(GL_TEXTURE_2D, pages_[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, page_width_[i], page_height_[i],
+        0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    set_filter(page_linear_[i] ? GL_LINEAR : GL_NEAREST);
+  }
+
+  if (lut_rows_) {
+    if (!lut_)
+      glGenTextures(1, &lut_);
+    glBindTexture(GL_TEXTURE_2D, lut_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, lut_rows_, 0,
+        GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    set_filter(GL_NEAREST);
+  } else if (lut_) {
+    glDeleteTextures(1, &lut_);
+    lut_ = 0;
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void mosaic::build_vertices(const std::vector<mosaic_rect>& rects) {
+  vertices_.clear();
+  page_first_.assign(pages_.size(), 0);
+  page_count_.assign(pages_.size(), 0);
+  for (size_t page = 0; page < pages_.size(); page++) {
+    page_first_[page] = GLint(vertices_.size() / kVertexFloats);
+    const float pw = float(page_width_[page]);
+    const float ph = float(page_height_[page]);
+    const float inset = page_linear_[page] ? 0.5f : 0.f;
+    for (size_t i = 0; i < tiles_.size(); i++) {
+      const tile& t = tiles_[i];
+      if (t.page != int(page))
+        continue;
+      const mosaic_rect r = fit(rects[i], t.width, t.height);
+      if (r.w <= 0 || r.h <= 0)
+        continue;
+      // The frame's pixels, without the chroma below them
+      const float luma_height = float(t.mode == DECODE_NV12 ||
+          t.mode == DECODE_I420 ? t.height : t.region_height);
+      const float s0 = (t.x + inset) / pw;
+      const float s1 = (t.x + t.region_width - inset) / pw;
+      const float t0 = (t.y + inset) / ph;
+      const float t1 = (t.y + luma_height - inset) / ph;
+      // Chroma texel = (luma texel - luma origin) / 2 + chroma origin; U
+      // sits below the luma, and for I420 V to the right of U
+      const float u_s = (t.x - 0.5f * t.x) / pw;
+      const float u_t = (t.y + luma_height - 0.5f * t.y) / ph;
+      const float v_s = t.width / 2 / pw;
+      const float mode = float(t.mode);
+      const float row = float(t.lut_row);
+      const float quad[kTileVertices * kVertexFloats] = {
+        r.x,       r.y,       s0, t0, u_s, u_t, v_s, 0, mode, row,
+        r.x + r.w, r.y,       s1, t0, u_s, u_t, v_s, 0, mode, row,
+        r.x + r.w, r.y + r.h, s1, t1, u_s, u_t, v_s, 0, mode, row,
+        r.x,       r.y,       s0, t0, u_s, u_t, v_s, 0, mode, row,
+        r.x + r.w, r.y + r.h, s1, t1, u_s, u_t, v_s, 0, mode, row,
+        r.x,       r.y + r.h, s0, t1, u_s, u_t, v_s, 0, mode, row,
+      };
+      vertices_.insert(vertices_.end(), quad, quad + sizeof(quad) / sizeof(*quad));
+      page_count_[page] += kTileVertices;
+    }
+  }
+
+  if (!GLEW_VERSION_1_5)
+    return;
+  if (!vbo_)
+    glGenBuffers(1, &vbo_);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+  glBufferData(GL_ARRAY_BUFFER, vertices_.size() * sizeof(float),
+      vertices_.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Bring the tile's rows of the table texture up to date for this frame;
+// only rows holding its depths have to be current
+void mosaic::update_table(tile& t, const uint16_t* depth, int stride) {
+  const uint32_t* table =
+      t.colorizer->build_lut(depth, t.width, t.height, stride);
+  const bool full = !t.table;
+  if (!full && t.table == table && t.version == t.colorizer->rebuilds() &&
+      t.map == t.colorizer->active_colormap())
+    return;
+
+  depth_range r = t.colorizer->lut_range();
+  int first = 0, last = 255;
+  if (!full) {
+    if (r.empty()) r = { 0, 0 };
+    first = r.lo >> 8;
+    last = r.hi >> 8;
+  }
+  glBindTexture(GL_TEXTURE_2D, lut_);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, t.lut_row + first, 256,
+      last - first + 1, GL_RGBA, GL_UNSIGNED_BYTE, table + first * 256);
+
+  t.table = table;
+  t.version = t.colorizer->rebuilds();
+  t.map = t.colorizer->active_colormap();
+}
+
+void mosaic::upload(unsigned index, const mosaic_stream& stream) {
+  tile& t = tiles_[index];
+  if (!stream.data || t.page < 0)
+    return;
+  const GLuint texture = pages_[t.page];
+  if (std::isnan(stream.frame))
+    forget_frame(texture, index);
+  else if (frame_cached(texture, { stream.frame, stream.format, t.width,
+               t.height, stream.data, stream.layout }, index))
+    return;
+
+  const pixel_format_traits& traits = format_traits(stream.format);
+  const size_t pixel_bytes = traits.bits_per_pixel / 8;
+  const size_t stride = stream.layout.stride ?
+      stream.layout.stride : t.width * pixel_bytes;
+  const uint8_t* origin = stream.data + stream.layout.y * stride +
+      stream.layout.x * pixel_bytes;
+
+  if (stream.format == PIXEL_FORMAT_Z16 && !t.colorizer)
+    t.colorizer.reset(new depth_colorizer());
+  if (t.mode == DECODE_Z16)
+    update_table(t, reinterpret_cast<const uint16_t *>(origin),
+        int(stride / 2));
+
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  if (t.mode == DECODE_Z16) {
+    unpack_layout unpack(stream.layout, 2);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, t.x, t.y, t.width, t.height,
+        GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, stream.data);
+  } else if (t.mode == DECODE_YUYV || t.mode == DECODE_UYVY) {
+    frame_layout texels = stream.layout;
+    texels.x /= 2;
+    unpack_layout unpack(texels, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, t.x, t.y, t.region_width, t.height,
+        GL_RGBA, GL_UNSIGNED_BYTE, stream.data);
+  } else if (t.mode == DECODE_NV12 || t.mode == DECODE_I420) {
+    // Planar frames are always packed
+    const int cw = t.width / 2, ch = t.height / 2;
+    const uint8_t* u = stream.data + size_t(t.width) * t.height;
+    glTexSubImage2D(GL_TEXTURE_2D, 0, t.x, t.y, t.width, t.height,
+        GL_LUMINANCE, GL_UNSIGNED_BYTE, stream.data);
+    if (t.mode == DECODE_NV12) {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, t.x, t.y + t.height, cw, ch,
+          GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, u);
+    } else {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, t.x, t.y + t.height, cw, ch,
+          GL_LUMINANCE, GL_UNSIGNED_BYTE, u);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, t.x + cw, t.y + t.height, cw, ch,
+          GL_LUMINANCE, GL_UNSIGNED_BYTE, u + size_t(cw) * ch);
+    }
+  } else if (stream.format == PIXEL_FORMAT_Z16) {
+    const uint8_t* rgb = t.colorizer->colorize(
+        reinterpret_cast<const uint16_t *>(origin), t.width, t.height,
+        int(stride / 2));
+    glTexSubImage2D(GL_TEXTURE_2D, 0, t.x, t.y, t.width, t.height,
+        GL_RGB, GL_UNSIGNED_BYTE, rgb);
+  } else if (is_yuv_format(stream.format)) {
+    static std::vector<uint8_t> rgba;
+    rgba.resize(size_t(t.width) * t.height * 4);
+    convert_yuv_to_rgba(rgba.data(), origin, t.width, t.height,
+        stream.format, stride);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, t.x, t.y, t.width, t.height,
+        GL_RGBA, GL_UNSIGNED_BYTE, rgba.data());
+  } else {
+    unpack_layout unpack(stream.layout, unsigned(pixel_bytes));
+    glTexSubImage2D(GL_TEXTURE_2D, 0, t.x, t.y, t.width, t.height,
+        traits.format, traits.type, stream.data);
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void mosaic::draw(int window_width, int window_height,
+                  const std::vector<mosaic_stream>& streams,
+                  const mosaic_layout& layout) {
+  if (!tried_) {
+    tried_ = true;
+    program_ = compile_program(nullptr, kMosaicFragmentShader);
+    if (program_) {
+      glUseProgram(program_);
+      glUniform1i(glGetUniformLocation(program_, "atlas_tex"), 0);
+      glUniform1i(glGetUniformLocation(program_, "lut_tex"), 1);
+      page_size_ = glGetUniformLocation(program_, "page_size");
+      lut_size_ = glGetUniformLocation(program_, "lut_size");
+      glUseProgram(0);
+    }
+  }
+
+  if (!same_streams(window_width, window_height, streams, layout)) {
+    window_width_ = window_width;
+    window_height_ = window_height;
+    layout_ = layout;
+    tiles_.resize(streams.size());
+    for (size_t i = 0; i < streams.size(); i++) {
+      tile& t = tiles_[i];
+      const mosaic_stream& s = streams[i];
+      t.format = s.format;
+      t.width = s.data ? s.width : 0;
+      t.height = s.data ? s.height : 0;
+      t.mode = decode_for(s);
+    }
+    pack();
+    build_vertices(
+        tile_rects(window_width, window_height, layout, streams.size()));
+  }
+
+  for (size_t i = 0; i < streams.size(); i++)
+    upload(unsigned(i), streams[i]);
+  if (vertices_.empty())
+    return;
+
+  if (vbo_)
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+  // Where the attribute starting floats into each vertex is: an offset into
+  // the buffer, or a pointer into vertices_
+  auto attribute = [this](size_t floats) {
+    return vbo_ ? reinterpret_cast<const float*>(floats * sizeof(float)) :
+        vertices_.data() + floats;
+  };
+  const GLsizei stride = kVertexFloats * sizeof(float);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(2, GL_FLOAT, stride, attribute(0));
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glTexCoordPointer(2, GL_FLOAT, stride, attribute(2));
+  if (program_) {
+    glClientActiveTexture(GL_TEXTURE1);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(4, GL_FLOAT, stride, attribute(4));
+    glClientActiveTexture(GL_TEXTURE2);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glTexCoordPointer(2, GL_FLOAT, stride, attribute(8));
+    glClientActiveTexture(GL_TEXTURE0);
+
+    glUseProgram(program_);
+    glUniform2f(lut_size_, 256.f, float(std::max(lut_rows_, 1)));
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, lut_);
+    glActiveTexture(GL_TEXTURE0);
+  }
+  glEnable(GL_TEXTURE_2D);
+  for (size_t page = 0; page < pages_.size(); page++) {
+    if (!page_count_[page])
+      continue;
+    if (program_)
+      glUniform2f(page_size_, float(page_width_[page]),
+          float(page_height_[page]));
+    glBindTexture(GL_TEXTURE_2D, pages_[page]);
+    glDrawArrays(GL_TRIANGLES, page_first_[page], page_count_[page]);
+  }
+  glDisable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  if (program_) {
+    glUseProgram(0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    for (GLenum unit : { GL_TEXTURE2, GL_TEXTURE1 }) {
+      glClientActiveTexture(unit);
+      glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    }
+    glClientActiveTexture(GL_TEXTURE0);
+  }
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  if (vbo_)
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+} // namespace glfw
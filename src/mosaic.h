@@ -0,0 +1,129 @@
+/*
+ * mosaic.h
+ *
+ */
+
+#ifndef MOSAIC_H_
+#define MOSAIC_H_
+
+#include "depth_colorizer.h"
+#include "pixel_format.h"
+#include "shader.h"
+#include "texture_upload.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace glfw {
+
+struct mosaic_rect {
+  float x, y, w, h;
+};
+
+// Where tiles go: explicit rects (in window pixels, one per stream) when
+// given, otherwise a grid of columns x rows, chosen to be about square when
+// either is 0.
+struct mosaic_layout {
+  unsigned columns = 0, rows = 0;
+  std::vector<mosaic_rect> rects;
+};
+
+// One tile's frame; tiles without data are left empty
+struct mosaic_stream {
+  const uint8_t* data = nullptr;
+  pixel_format format = PIXEL_FORMAT_UNKNOWN;
+  uint32_t width = 0, height = 0;
+  frame_layout layout;
+  double frame = kNoFrame;
+};
+
+// Draws any number of streams into one window. Frames are packed into a
+// shared atlas texture as they arrive and decoded by one fragment shader,
+// which tells z16, packed and planar YUV and plain tiles apart by a vertex
+// attribute, so all tiles are drawn in a single glDrawArrays with one set of
+// state (one per atlas page, when the frames do not fit into
+// GL_MAX_TEXTURE_SIZE together). Without shaders, or with GPU colorizing
+// off for z16, frames are converted to RGB on the CPU instead. Tile rects,
+// atlas packing and the vertex buffer are only redone when the window size,
+// the layout or the format or size of a stream changes.
+class mosaic {
+ public:
+  mosaic() = default;
+  // Needs the context the mosaic drew into to be current
+  ~mosaic();
+
+  // Draw into the current viewport, which spans window_width x
+  // window_height with y pointing down
+  void draw(int window_width, int window_height,
+            const std::vector<mosaic_stream>& streams,
+            const mosaic_layout& layout);
+
+ private:
+  mosaic(const mosaic&) = delete;
+  mosaic& operator=(const mosaic&) = delete;
+
+  // How a tile's frame is held in the atlas and turned into colors. The
+  // values are passed to the shader.
+  enum decode {
+    // RGB(A) or luminance, as uploaded or converted on the CPU
+    DECODE_NONE,
+    // Low byte in red, high byte in alpha, looked up in the tile's 256 rows
+    // of the table texture
+    DECODE_Z16,
+    // One RGBA texel per pair of pixels
+    DECODE_YUYV,
+    DECODE_UYVY,
+    // Luma, with the chroma plane(s) below it
+    DECODE_NV12,
+    DECODE_I420
+  };
+
+  struct tile {
+    pixel_format format;
+    uint32_t width, height;
+    decode mode;
+    // Placement in the atlas; page < 0 for frames that do not fit at all
+    int page, x, y;
+    // Size of the tile's region in the atlas, in texels
+    int region_width, region_height;
+    // First of the tile's rows in the table texture
+    int lut_row;
+    std::unique_ptr<depth_colorizer> colorizer;
+    // What the tile's rows of the table texture hold
+    const uint32_t* table;
+    unsigned long version;
+    std::shared_ptr<const colormap> map;
+  };
+
+  decode decode_for(const mosaic_stream& stream) const;
+  bool same_streams(int window_width, int window_height,
+                    const std::vector<mosaic_stream>& streams,
+                    const mosaic_layout& layout) const;
+  void pack();
+  void build_vertices(const std::vector<mosaic_rect>& rects);
+  void update_table(tile& t, const uint16_t* depth, int stride);
+  void upload(unsigned index, const mosaic_stream& stream);
+
+  int window_width_ = 0, window_height_ = 0;
+  mosaic_layout layout_;
+  std::vector<tile> tiles_;
+  std::vector<GLuint> pages_;
+  std::vector<int> page_width_, page_height_;
+  // Pages holding only DECODE_NONE tiles, which may be filtered
+  std::vector<bool> page_linear_;
+  // 256 wide, 256 rows per GPU colorized z16 tile
+  GLuint lut_ = 0;
+  int lut_rows_ = 0;
+  GLuint program_ = 0;
+  GLint page_size_ = -1, lut_size_ = -1;
+  bool tried_ = false;
+  // Vertices of each page's tiles, in page order
+  std::vector<GLint> page_first_, page_count_;
+  std::vector<float> vertices_;
+  GLuint vbo_ = 0;
+};
+
+} // namespace glfw
+
+#endif /* MOSAIC_H_ */
@@ -0,0 +1,44 @@
+/*
+ * pixel_format.cc
+ *
+ */
+
+#include "pixel_format.h"
+
+namespace glfw {
+
+static_assert(sizeof(kPixelFormats) / sizeof(kPixelFormats[0]) ==
+    PIXEL_FORMAT_COUNT, "kPixelFormats needs an entry per pixel_format");
+
+pixel_format pixel_format_from_id(int id) {
+  if (id <= PIXEL_FORMAT_UNKNOWN || id >= PIXEL_FORMAT_COUNT)
+    return PIXEL_FORMAT_UNKNOWN;
+  return pixel_format(id);
+}
+
+size_t frame_span(pixel_format format, int width, int height,
+                  const frame_layout& layout) {
+  const pixel_format_traits& traits = format_traits(format);
+  if (layout.packed())
+    return size_t(width) * height * traits.bits_per_pixel / 8;
+  const size_t pixel_bytes = traits.bits_per_pixel / 8;
+  const size_t row_bytes = size_t(width) * pixel_bytes;
+  const size_t stride = layout.stride ? layout.stride : row_bytes;
+  if (format == PIXEL_FORMAT_NV12 || format == PIXEL_FORMAT_I420 ||
+      (layout.x && !layout.stride) || stride < row_bytes ||
+      stride % pixel_bytes ||
+      layout.x % traits.block_width || layout.y % traits.block_height)
+    return 0;
+  return (size_t(layout.y) + height - 1) * stride +
+      (size_t(layout.x) + width) * pixel_bytes;
+}
+
+pixel_format pixel_format_from_name(const std::string& name) {
+  for (int id = PIXEL_FORMAT_UNKNOWN + 1; id < PIXEL_FORMAT_COUNT; id++) {
+    if (name == kPixelFormats[id].name)
+      return pixel_format(id);
+  }
+  return PIXEL_FORMAT_UNKNOWN;
+}
+
+} // namespace glfw
@@ -0,0 +1,92 @@
+/*
+ * pixel_format.h
+ *
+ */
+
+#ifndef PIXEL_FORMAT_H_
+#define PIXEL_FORMAT_H_
+
+#include "shader.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace glfw {
+
+// Frame formats understood by the upload paths. The values are exported to
+// JS as FORMAT_* constants, so only ever append.
+enum pixel_format {
+  PIXEL_FORMAT_UNKNOWN = 0,
+  PIXEL_FORMAT_Z16,
+  PIXEL_FORMAT_RGB8,
+  PIXEL_FORMAT_Y8,
+  PIXEL_FORMAT_RAW8,
+  PIXEL_FORMAT_Y16,
+  PIXEL_FORMAT_YUYV,
+  PIXEL_FORMAT_UYVY,
+  PIXEL_FORMAT_NV12,
+  PIXEL_FORMAT_I420,
+  PIXEL_FORMAT_COUNT
+};
+
+struct pixel_format_traits {
+  const char* name;
+  // Size of one pixel of the frame as it arrives, averaged over all planes
+  unsigned bits_per_pixel;
+  // Frame width and height must be multiples of these (chroma subsampling)
+  unsigned block_width, block_height;
+  // How the texture is specified and the pixels handed to GL. For converted
+  // formats this describes the converted pixels.
+  GLenum internal_format;
+  GLenum format;
+  GLenum type;
+  // Whether the frame goes through a conversion kernel before upload
+  bool converted;
+};
+
+constexpr pixel_format_traits kPixelFormats[] = {
+  { "", 0, 1, 1, 0, 0, 0, false },
+  { "z16", 16, 1, 1, GL_RGB, GL_RGB, GL_UNSIGNED_BYTE, true },
+  { "rgb8", 24, 1, 1, GL_RGB, GL_RGB, GL_UNSIGNED_BYTE, false },
+  { "y8", 8, 1, 1, GL_RGB, GL_LUMINANCE, GL_UNSIGNED_BYTE, false },
+  { "raw8", 8, 1, 1, GL_LUMINANCE, GL_LUMINANCE, GL_UNSIGNED_BYTE, false },
+  { "y16", 16, 1, 1, GL_LUMINANCE, GL_LUMINANCE, GL_UNSIGNED_SHORT, false },
+  { "yuyv", 16, 2, 1, GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE, true },
+  { "uyvy", 16, 2, 1, GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE, true },
+  { "nv12", 12, 2, 2, GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE, true },
+  { "i420", 12, 2, 2, GL_RGBA, GL_RGBA, GL_UNSIGNED_BYTE, true },
+};
+
+constexpr const pixel_format_traits& format_traits(pixel_format format) {
+  return kPixelFormats[format];
+}
+
+constexpr bool frame_size_valid(pixel_format format, int width, int height) {
+  return width % kPixelFormats[format].block_width == 0 &&
+      height % kPixelFormats[format].block_height == 0;
+}
+
+// Where a frame sits in its buffer: rows stride bytes apart (0 when they are
+// width pixels long), starting x pixels into row y. An x offset needs a
+// stride.
+struct frame_layout {
+  uint32_t stride = 0;
+  uint32_t x = 0, y = 0;
+
+  bool packed() const { return !stride && !x && !y; }
+};
+
+// Planar formats only come tightly packed, since their chroma planes follow
+// the full luma plane. Returns the bytes the frame spans, or 0 if layout
+// does not fit format and width.
+size_t frame_span(pixel_format format, int width, int height,
+                  const frame_layout& layout);
+
+// PIXEL_FORMAT_UNKNOWN for anything out of range
+pixel_format pixel_format_from_id(int id);
+pixel_format pixel_format_from_name(const std::string& name);
+
+} // namespace glfw
+
+#endif /* PIXEL_FORMAT_H_ */
@@ -0,0 +1,416 @@
+/*
+ * point_cloud.cc
+ *
+ * Each update orphans the vertex buffer and writes the points straight
+ * into the new storage through glMapBufferRange, so that neither waits for
+ * the GPU to finish drawing the previous frame nor goes through a copy.
+ * Decimated clouds are the exception: they are thinned in memory first, as
+ * mapped storage is write only, and only the points left are uploaded.
+ *
+ * Compaction has AVX2 and NEON versions next to the scalar one, picked once
+ * at runtime. None of them branches per point: the vector versions test 8
+ * (4) depths at once and only visit the points that have one, the scalar
+ * one writes every point and advances past it only if it has a depth.
+ */
+
+#include "point_cloud.h"
+#include "texture_upload.h"
+
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define POINT_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define POINT_TARGET(isa)
+#else
+#define POINT_TARGET(isa) __attribute__((target(isa)))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define POINT_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace glfw {
+
+namespace {
+
+const char* kDeprojectVertexShader =
+    "#version 110\n"
+    "uniform sampler2D depth_tex;\n"
+    "uniform vec2 depth_size;\n"
+    "uniform float depth_scale;\n"
+    // ppx, ppy, fx, fy
+    "uniform vec4 depth_intrin;\n"
+    "uniform vec4 color_intrin;\n"
+    "uniform vec2 color_size;\n"
+    "uniform mat3 rotation;\n"
+    "uniform vec3 translation;\n"
+    "void main() {\n"
+    "  vec2 pixel = gl_Vertex.xy;\n"
+    "  float z = texture2D(depth_tex, (pixel + 0.5) / depth_size).r;\n"
+    "  z = floor(z * 65535.0 + 0.5) * depth_scale;\n"
+    "  vec3 p = vec3((pixel - depth_intrin.xy) / depth_intrin.zw * z, z);\n"
+    "  vec3 c = rotation * p + translation;\n"
+    "  vec2 at = c.xy / c.z * color_intrin.zw + color_intrin.xy;\n"
+    "  gl_TexCoord[0] = vec4(at / color_size, 0.0, 1.0);\n"
+    "  gl_FrontColor = gl_Color;\n"
+    "  gl_Position = z > 0.0 ? gl_ModelViewProjectionMatrix * vec4(p, 1.0)\n"
+    "                        : vec4(2.0, 2.0, 2.0, 1.0);\n"
+    "}\n";
+
+struct deproject_objects {
+  ~deproject_objects() {
+    if (program)
+      glDeleteProgram(program);
+  }
+
+  GLuint program = 0;
+  bool tried = false;
+};
+
+per_context<deproject_objects> programs;
+
+GLuint deproject_program() {
+  deproject_objects& o = programs.current();
+  if (!o.tried) {
+    o.tried = true;
+    o.program = compile_program(kDeprojectVertexShader, nullptr);
+    if (o.program) {
+      glUseProgram(o.program);
+      glUniform1i(glGetUniformLocation(o.program, "depth_tex"), 1);
+      glUseProgram(0);
+    }
+  }
+  return o.program;
+}
+
+typedef size_t (*compact_kernel)(float* out, const float* vertices,
+                                 const float* tex_coords, size_t count);
+
+size_t compact_scalar(float* out, const float* vertices,
+                      const float* tex_coords, size_t count) {
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    const float* v = vertices + i * 3;
+    float* p = out + n * kPointFloats;
+    p[0] = v[0];
+    p[1] = v[1];
+    p[2] = v[2];
+    p[3] = tex_coords[i * 2];
+    p[4] = tex_coords[i * 2 + 1];
+    // out has room for every point, so the write of a hole is harmless
+    n += v[2] != 0;
+  }
+  return n;
+}
+
+#ifdef POINT_X86
+
+bool cpu_has_avx2() {
+#ifdef _MSC_VER
+  int regs[4];
+  __cpuid(regs, 1);
+  bool osxsave = (regs[2] & (1 << 27)) != 0;
+  if (!osxsave || (_xgetbv(0) & 6) != 6) return false;
+  __cpuidex(regs, 7, 0);
+  return (regs[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+inline int lowest_bit(unsigned mask) {
+#ifdef _MSC_VER
+  unsigned long k;
+  _BitScanForward(&k, mask);
+  return int(k);
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+POINT_TARGET("avx2")
+size_t compact_avx2(float* out, const float* vertices,
+                    const float* tex_coords, size_t count) {
+  const __m256i z_index = _mm256_setr_epi32(2, 5, 8, 11, 14, 17, 20, 23);
+  const __m256 zero = _mm256_setzero_ps();
+  size_t n = 0, i = 0;
+  // Each point is copied with a 16 byte load of x, y, z and the next x, so
+  // the last point is left to the scalar loop
+  for (; i + 8 < count; i += 8) {
+    const float* v = vertices + i * 3;
+    const float* t = tex_coords + i * 2;
+    __m256 z = _mm256_i32gather_ps(v, z_index, 4);
+    unsigned mask = unsigned(_mm256_movemask_ps(
+        _mm256_cmp_ps(z, zero, _CMP_NEQ_UQ)));
+    while (mask) {
+      const int k = lowest_bit(mask);
+      mask &= mask - 1;
+      float* p = out + n++ * kPointFloats;
+      // x, y, z and a stray float, which u, v then overwrite
+      _mm_storeu_ps(p, _mm_loadu_ps(v + k * 3));
+      _mm_storel_pi(reinterpret_cast<__m64*>(p + 3),
+          _mm_castpd_ps(_mm_load_sd(reinterpret_cast<const double*>(t + k * 2))));
+    }
+  }
+  return n + compact_scalar(out + n * kPointFloats, vertices + i * 3,
+      tex_coords + i * 2, count - i);
+}
+
+#endif // POINT_X86
+
+#ifdef POINT_NEON
+
+size_t compact_neon(float* out, const float* vertices,
+                    const float* tex_coords, size_t count) {
+  size_t n = 0, i = 0;
+  for (; i + 4 <= count; i += 4) {
+    float32x4x3_t v = vld3q_f32(vertices + i * 3);
+    float32x4x2_t t = vld2q_f32(tex_coords + i * 2);
+    uint32x4_t valid = vmvnq_u32(vceqq_f32(v.val[2], vdupq_n_f32(0)));
+    if (!vmaxvq_u32(valid))
+      continue;
+    // Transpose x, y, z, u into one x, y, z, u vector per point
+    float32x4x2_t xy = vtrnq_f32(v.val[0], v.val[1]);
+    float32x4x2_t zu = vtrnq_f32(v.val[2], t.val[0]);
+    const float32x4_t point[4] = {
+      vcombine_f32(vget_low_f32(xy.val[0]), vget_low_f32(zu.val[0])),
+      vcombine_f32(vget_low_f32(xy.val[1]), vget_low_f32(zu.val[1])),
+      vcombine_f32(vget_high_f32(xy.val[0]), vget_high_f32(zu.val[0])),
+      vcombine_f32(vget_high_f32(xy.val[1]), vget_high_f32(zu.val[1])),
+    };
+    float tv[4];
+    uint32_t keep[4];
+    vst1q_f32(tv, t.val[1]);
+    vst1q_u32(keep, vshrq_n_u32(valid, 31));
+    for (int k = 0; k < 4; k++) {
+      float* p = out + n * kPointFloats;
+      vst1q_f32(p, point[k]);
+      p[4] = tv[k];
+      n += keep[k];
+    }
+  }
+  return n + compact_scalar(out + n * kPointFloats, vertices + i * 3,
+      tex_coords + i * 2, count - i);
+}
+
+#endif // POINT_NEON
+
+struct compact_kernels {
+  const char* name;
+  compact_kernel compact;
+};
+
+compact_kernels select_kernels() {
+#ifdef POINT_X86
+  if (cpu_has_avx2()) return { "avx2", compact_avx2 };
+#endif
+#ifdef POINT_NEON
+  return { "neon", compact_neon };
+#endif
+  return { "scalar", compact_scalar };
+}
+
+const compact_kernels& kernels() {
+  static const compact_kernels k = select_kernels();
+  return k;
+}
+
+} // namespace
+
+size_t compact_points(float* out, const float* vertices,
+                      const float* tex_coords, size_t count) {
+  return kernels().compact(out, vertices, tex_coords, count);
+}
+
+const char* point_kernel_name() {
+  return kernels().name;
+}
+
+point_cloud::~point_cloud() {
+  if (vbo_)
+    glDeleteBuffers(1, &vbo_);
+}
+
+size_t point_cloud::update(const float* vertices, const float* tex_coords,
+                           size_t count) {
+  return fill(count, [&](float* out) {
+    return compact_points(out, vertices, tex_coords, count);
+  });
+}
+
+size_t point_cloud::update(const uint16_t* depth, int stride,
+                           const deprojection& d) {
+  return fill(size_t(d.depth.width) * d.depth.height, [&](float* out) {
+    return deproject_points(out, depth, stride, d);
+  });
+}
+
+size_t point_cloud::fill(size_t count,
+                         const std::function<size_t(float*)>& write) {
+  const size_t bytes = count * kPointFloats * sizeof(float);
+  const bool decimate = point_decimation_enabled();
+  if (!GLEW_VERSION_1_5 || decimate) {
+    points_.resize(count * kPointFloats);
+    size_ = write(points_.data());
+    if (decimate)
+      size_ = decimator_.apply(points_.data(), size_, kPointFloats);
+    if (!GLEW_VERSION_1_5)
+      return size_;
+    if (!vbo_)
+      glGenBuffers(1, &vbo_);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    glBufferData(GL_ARRAY_BUFFER, size_ * kPointFloats * sizeof(float),
+        points_.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return size_;
+  }
+
+  if (!vbo_)
+    glGenBuffers(1, &vbo_);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+  glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+  float* mapped = nullptr;
+  if (bytes && (GLEW_VERSION_3_0 || GLEW_ARB_map_buffer_range)) {
+    mapped = static_cast<float*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+  }
+  if (mapped) {
+    size_ = write(mapped);
+    if (!glUnmapBuffer(GL_ARRAY_BUFFER))
+      size_ = 0; // Storage was lost; skip this frame
+  } else {
+    points_.resize(count * kPointFloats);
+    size_ = write(points_.data());
+    glBufferSubData(GL_ARRAY_BUFFER, 0,
+        size_ * kPointFloats * sizeof(float), points_.data());
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  return size_;
+}
+
+void point_cloud::draw() const {
+  if (!size_)
+    return;
+  const float* positions;
+  const float* tex_coords;
+  if (vbo_) {
+    glBindBuffer(GL_ARRAY_BUFFER, vbo_);
+    // Offsets into the buffer
+    positions = nullptr;
+    tex_coords = reinterpret_cast<const float*>(3 * sizeof(float));
+  } else {
+    positions = points_.data();
+    tex_coords = positions + 3;
+  }
+  const GLsizei stride = kPointFloats * sizeof(float);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glVertexPointer(3, GL_FLOAT, stride, positions);
+  glTexCoordPointer(2, GL_FLOAT, stride, tex_coords);
+  glDrawArrays(GL_POINTS, 0, GLsizei(size_));
+  glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  if (vbo_)
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+depth_point_cloud::~depth_point_cloud() {
+  if (depth_texture_) {
+    forget_texture_storage(depth_texture_);
+    glDeleteTextures(1, &depth_texture_);
+  }
+  if (grid_)
+    glDeleteBuffers(1, &grid_);
+}
+
+bool depth_point_cloud::supported() {
+  if (!shaders_supported() || !GLEW_VERSION_1_5)
+    return false;
+  GLint units = 0;
+  glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS, &units);
+  return units > 0 && deproject_program();
+}
+
+void depth_point_cloud::upload(const uint16_t* depth,
+                               const intrinsics& depth_intrin, int stride) {
+  depth_intrin_ = depth_intrin;
+  const int width = depth_intrin.width, height = depth_intrin.height;
+  if (!depth_texture_)
+    glGenTextures(1, &depth_texture_);
+  frame_layout layout;
+  layout.stride = stride ? uint32_t(stride) * 2 : 0;
+  {
+    unpack_layout unpack(layout, 2);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    upload_texture_image(depth_texture_, GL_LUMINANCE16, width, height,
+        GL_LUMINANCE, GL_UNSIGNED_SHORT, depth);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  }
+  // Vertex shaders sample level 0 only; depths must not be blended
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  if (grid_ && grid_width_ == width && grid_height_ == height)
+    return;
+  // The grid only changes with the depth resolution
+  std::vector<GLshort> pixels(size_t(width) * height * 2);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      pixels[(size_t(y) * width + x) * 2] = GLshort(x);
+      pixels[(size_t(y) * width + x) * 2 + 1] = GLshort(y);
+    }
+  }
+  if (!grid_)
+    glGenBuffers(1, &grid_);
+  glBindBuffer(GL_ARRAY_BUFFER, grid_);
+  glBufferData(GL_ARRAY_BUFFER, pixels.size() * sizeof(GLshort),
+      pixels.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  grid_width_ = width;
+  grid_height_ = height;
+}
+
+void depth_point_cloud::draw(float depth_scale,
+                             const intrinsics& color_intrin,
+                             const extrinsics& depth_to_color) const {
+  const GLuint program = deproject_program();
+  if (!program || !grid_)
+    return;
+  glUseProgram(program);
+  glUniform2f(glGetUniformLocation(program, "depth_size"),
+      float(depth_intrin_.width), float(depth_intrin_.height));
+  glUniform1f(glGetUniformLocation(program, "depth_scale"), depth_scale);
+  glUniform4f(glGetUniformLocation(program, "depth_intrin"),
+      depth_intrin_.ppx, depth_intrin_.ppy, depth_intrin_.fx, depth_intrin_.fy);
+  glUniform4f(glGetUniformLocation(program, "color_intrin"),
+      color_intrin.ppx, color_intrin.ppy, color_intrin.fx, color_intrin.fy);
+  glUniform2f(glGetUniformLocation(program, "color_size"),
+      float(color_intrin.width), float(color_intrin.height));
+  glUniformMatrix3fv(glGetUniformLocation(program, "rotation"), 1, GL_FALSE,
+      depth_to_color.rotation);
+  glUniform3fv(glGetUniformLocation(program, "translation"), 1,
+      depth_to_color.translation);
+
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, depth_texture_);
+  glActiveTexture(GL_TEXTURE0);
+
+  glBindBuffer(GL_ARRAY_BUFFER, grid_);
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(2, GL_SHORT, 0, nullptr);
+  glDrawArrays(GL_POINTS, 0, grid_width_ * grid_height_);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glUseProgram(0);
+}
+
+} // namespace glfw
@@ -0,0 +1,101 @@
+/*
+ * point_cloud.h
+ *
+ */
+
+#ifndef POINT_CLOUD_H_
+#define POINT_CLOUD_H_
+
+#include "camera.h"
+#include "decimation.h"
+#include "deproject.h"
+#include "shader.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace glfw {
+
+// x, y, z, u, v of one point as stored in the vertex buffer
+const int kPointFloats = 5;
+
+// Interleave the points of vertices (x, y, z) that have a depth with their
+// tex_coords (u, v) into out, which has room for count points. Returns how
+// many were written.
+size_t compact_points(float* out, const float* vertices,
+                      const float* tex_coords, size_t count);
+const char* point_kernel_name();
+
+// The points of a depth frame in one vertex buffer, drawn with a single
+// glDrawArrays. Needs a current context for its whole lifetime. Points are
+// decimated before the upload while set_point_decimation() asks for it.
+class point_cloud {
+ public:
+  point_cloud() = default;
+  ~point_cloud();
+
+  // Replace the points with those of vertices that have a depth; returns
+  // how many that are
+  size_t update(const float* vertices, const float* tex_coords,
+                size_t count);
+  // Or deproject them from a z16 frame on the CPU, straight into the
+  // buffer. Rows of depth are stride pixels apart (0 for d.depth.width).
+  size_t update(const uint16_t* depth, int stride, const deprojection& d);
+
+  // Draw the points with the current texture, transforms and point size
+  void draw() const;
+
+  size_t size() const { return size_; }
+  const point_decimator& decimator() const { return decimator_; }
+
+ private:
+  point_cloud(const point_cloud&) = delete;
+  point_cloud& operator=(const point_cloud&) = delete;
+
+  // Let write() put up to count points into the buffer's new storage
+  size_t fill(size_t count, const std::function<size_t(float*)>& write);
+
+  GLuint vbo_ = 0;
+  size_t size_ = 0;
+  // The points, where they cannot be written into the buffer directly
+  std::vector<float> points_;
+  point_decimator decimator_;
+};
+
+// Points deprojected from a raw z16 frame in a vertex shader. Only the depth
+// frame is uploaded (2 bytes per point); a static grid of pixel coordinates
+// is drawn, and each vertex fetches its depth, deprojects it with the depth
+// intrinsics and projects it into the color stream for its texture
+// coordinate. Pixels without depth are moved out of the clip volume.
+class depth_point_cloud {
+ public:
+  depth_point_cloud() = default;
+  ~depth_point_cloud();
+
+  // False where the context cannot sample textures in vertex shaders
+  static bool supported();
+
+  // Rows of depth are stride pixels apart (0 for depth_intrin.width)
+  void upload(const uint16_t* depth, const intrinsics& depth_intrin,
+              int stride = 0);
+
+  // Draw with the color texture bound on unit 0 and fixed function
+  // texturing enabled. depth_scale is meters per z16 unit.
+  void draw(float depth_scale, const intrinsics& color_intrin,
+            const extrinsics& depth_to_color) const;
+
+ private:
+  depth_point_cloud(const depth_point_cloud&) = delete;
+  depth_point_cloud& operator=(const depth_point_cloud&) = delete;
+
+  GLuint depth_texture_ = 0;
+  GLuint grid_ = 0;
+  intrinsics depth_intrin_;
+  int grid_width_ = 0, grid_height_ = 0;
+};
+
+} // namespace glfw
+
+#endif /* POINT_CLOUD_H_ */
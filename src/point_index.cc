@@ -0,0 +1,346 @@
+/*
+ * point_index.cc
+ *
+ * The grid is dense and built with a counting sort: one pass for the
+ * bounds, one to count points per cell and one to scatter them, so a build
+ * is linear in the points. Depth frames are surfaces, which fill few of the
+ * cells of their bounding box, so cells are sized for a handful of points
+ * on a surface and then grown until the grid has no more cells than twice
+ * the points. Queries visit the cells around the query point in growing
+ * shells (nearest), the cells overlapping a sphere (within) or spheres
+ * strung along the ray (pick).
+ */
+
+#include "point_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace glfw {
+
+namespace {
+
+// Points per cell wanted on a surface
+const float kSurfacePointsPerCell = 8;
+const size_t kCellsPerPoint = 2;
+// Smallest cell edge, in meters, so that points which all coincide still
+// make a grid with a usable cell size
+const float kMinCell = 1e-4f;
+// Most spheres a pick strings along its ray; longer rays take longer steps
+const size_t kMaxPickSteps = 0x10000;
+
+inline bool has_depth(const float* v) {
+  return v[2] != 0 && std::isfinite(v[0]) && std::isfinite(v[1]) &&
+      std::isfinite(v[2]);
+}
+
+inline float squared(float v) {
+  return v * v;
+}
+
+} // namespace
+
+point_index::~point_index() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_one();
+  if (builder_.joinable())
+    builder_.join();
+}
+
+void point_index::submit(const float* vertices, size_t count) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frame_.assign(vertices, vertices + count * 3);
+    pending_ = true;
+    if (!builder_.joinable())
+      builder_ = std::thread(&point_index::builder_main, this);
+  }
+  wake_.notify_one();
+}
+
+void point_index::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  pending_ = false;
+  epoch_++;
+  frame_.clear();
+  frame_.shrink_to_fit();
+  grid_.reset();
+}
+
+void point_index::builder_main() {
+  std::vector<float> vertices;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    wake_.wait(lock, [this] { return stop_ || pending_; });
+    if (stop_)
+      return;
+    vertices.swap(frame_);
+    pending_ = false;
+    const uint64_t epoch = epoch_;
+    lock.unlock();
+    std::shared_ptr<const grid> built = build(vertices);
+    lock.lock();
+    if (epoch == epoch_) {
+      grid_ = built;
+      builds_++;
+    }
+  }
+}
+
+std::shared_ptr<const point_index::grid> point_index::current() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return grid_;
+}
+
+size_t point_index::size() const {
+  std::shared_ptr<const grid> g = current();
+  return g ? g->index.size() : 0;
+}
+
+uint64_t point_index::builds() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return builds_;
+}
+
+std::shared_ptr<point_index::grid> point_index::build(
+    const std::vector<float>& vertices) {
+  std::shared_ptr<grid> g = std::make_shared<grid>();
+  const size_t count = vertices.size() / 3;
+  float lo[3], hi[3];
+  for (int a = 0; a < 3; a++) {
+    lo[a] = std::numeric_limits<float>::max();
+    hi[a] = std::numeric_limits<float>::lowest();
+  }
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    const float* v = &vertices[i * 3];
+    if (!has_depth(v))
+      continue;
+    for (int a = 0; a < 3; a++) {
+      lo[a] = std::min(lo[a], v[a]);
+      hi[a] = std::max(hi[a], v[a]);
+    }
+    n++;
+  }
+  if (!n)
+    return g;
+
+  float extent = 0;
+  for (int a = 0; a < 3; a++)
+    extent = std::max(extent, hi[a] - lo[a]);
+  float cell = std::max(extent * std::sqrt(kSurfacePointsPerCell / n),
+      kMinCell);
+  for (;;) {
+    double cells = 1;
+    for (int a = 0; a < 3; a++) {
+      g->dims[a] = int((hi[a] - lo[a]) / cell) + 1;
+      cells *= g->dims[a];
+    }
+    if (cells <= double(n) * kCellsPerPoint)
+      break;
+    cell *= 1.25f;
+  }
+  std::copy(lo, lo + 3, g->origin);
+  g->cell = cell;
+
+  const size_t cells = size_t(g->dims[0]) * g->dims[1] * g->dims[2];
+  const float inv_cell = 1 / cell;
+  std::vector<uint32_t> cell_of(count);
+  g->cell_start.assign(cells + 1, 0);
+  for (size_t i = 0; i < count; i++) {
+    const float* v = &vertices[i * 3];
+    if (!has_depth(v))
+      continue;
+    int c[3];
+    for (int a = 0; a < 3; a++)
+      c[a] = std::min(int((v[a] - lo[a]) * inv_cell), g->dims[a] - 1);
+    const uint32_t id =
+        uint32_t((size_t(c[2]) * g->dims[1] + c[1]) * g->dims[0] + c[0]);
+    cell_of[i] = id;
+    g->cell_start[id + 1]++;
+  }
+  for (size_t c = 0; c < cells; c++)
+    g->cell_start[c + 1] += g->cell_start[c];
+
+  std::vector<uint32_t> next(g->cell_start.begin(), g->cell_start.end() - 1);
+  g->index.resize(n);
+  g->points.resize(n * 3);
+  for (size_t i = 0; i < count; i++) {
+    const float* v = &vertices[i * 3];
+    if (!has_depth(v))
+      continue;
+    const uint32_t slot = next[cell_of[i]]++;
+    g->index[slot] = uint32_t(i);
+    std::copy(v, v + 3, &g->points[size_t(slot) * 3]);
+  }
+  return g;
+}
+
+bool point_index::nearest(const float p[3], float max_distance,
+                          indexed_point* found) const {
+  std::shared_ptr<const grid> g = current();
+  if (!g || g->index.empty())
+    return false;
+
+  int c[3];
+  int rings = 0;
+  for (int a = 0; a < 3; a++) {
+    const float f = std::floor((p[a] - g->origin[a]) / g->cell);
+    c[a] = int(std::max(0.f, std::min(f, float(g->dims[a] - 1))));
+    rings = std::max(rings, std::max(c[a], g->dims[a] - 1 - c[a]));
+  }
+
+  float best = std::isinf(max_distance) ? std::numeric_limits<float>::max()
+                                        : squared(max_distance);
+  bool any = false;
+  // Points in shell k are at least k - 1 cells away
+  for (int k = 0; k <= rings; k++) {
+    if (k > 1 && squared((k - 1) * g->cell) > best)
+      break;
+    const int z0 = std::max(c[2] - k, 0);
+    const int z1 = std::min(c[2] + k, g->dims[2] - 1);
+    const int y0 = std::max(c[1] - k, 0);
+    const int y1 = std::min(c[1] + k, g->dims[1] - 1);
+    const int x0 = std::max(c[0] - k, 0);
+    const int x1 = std::min(c[0] + k, g->dims[0] - 1);
+    for (int z = z0; z <= z1; z++) {
+      for (int y = y0; y <= y1; y++) {
+        const bool inner = std::abs(z - c[2]) < k && std::abs(y - c[1]) < k;
+        for (int x = x0; x <= x1; x++) {
+          // Only the surface of the shell; the inside was visited before
+          if (inner && std::abs(x - c[0]) < k)
+            x = c[0] + k;
+          if (x > x1)
+            break;
+          const size_t id = (size_t(z) * g->dims[1] + y) * g->dims[0] + x;
+          for (uint32_t i = g->cell_start[id]; i < g->cell_start[id + 1];
+               i++) {
+            const float* q = &g->points[size_t(i) * 3];
+            const float d = squared(q[0] - p[0]) + squared(q[1] - p[1]) +
+                squared(q[2] - p[2]);
+            if (d <= best) {
+              best = d;
+              any = true;
+              *found = { g->index[i], q[0], q[1], q[2], 0 };
+            }
+          }
+        }
+      }
+    }
+  }
+  if (any)
+    found->distance = std::sqrt(best);
+  return any;
+}
+
+void point_index::within(const float p[3], float radius,
+    const std::function<void(const indexed_point&)>& fn) const {
+  std::shared_ptr<const grid> g = current();
+  if (g)
+    within(*g, p, radius, fn);
+}
+
+void point_index::within(const grid& g, const float p[3], float radius,
+    const std::function<void(const indexed_point&)>& fn) {
+  if (g.index.empty() || !(radius >= 0))
+    return;
+
+  int lo[3], hi[3];
+  for (int a = 0; a < 3; a++) {
+    const float f0 = std::floor((p[a] - radius - g.origin[a]) / g.cell);
+    const float f1 = std::floor((p[a] + radius - g.origin[a]) / g.cell);
+    if (f1 < 0 || f0 > g.dims[a] - 1)
+      return;
+    lo[a] = int(std::max(f0, 0.f));
+    hi[a] = int(std::min(f1, float(g.dims[a] - 1)));
+  }
+  const float r2 = squared(radius);
+  for (int z = lo[2]; z <= hi[2]; z++) {
+    for (int y = lo[1]; y <= hi[1]; y++) {
+      const size_t row = (size_t(z) * g.dims[1] + y) * g.dims[0];
+      for (uint32_t i = g.cell_start[row + lo[0]];
+           i < g.cell_start[row + hi[0] + 1]; i++) {
+        const float* q = &g.points[size_t(i) * 3];
+        const float d = squared(q[0] - p[0]) + squared(q[1] - p[1]) +
+            squared(q[2] - p[2]);
+        if (d <= r2)
+          fn({ g.index[i], q[0], q[1], q[2], std::sqrt(d) });
+      }
+    }
+  }
+}
+
+bool point_index::pick(const float origin[3], const float direction[3],
+                       float spread, indexed_point* found) const {
+  std::shared_ptr<const grid> g = current();
+  if (!g || g->index.empty())
+    return false;
+
+  // Where the ray crosses the bounds (grown by the cone at the far side)
+  float t0 = 0, t1 = std::numeric_limits<float>::max();
+  float reach = 0;
+  for (int a = 0; a < 3; a++) {
+    const float lo = g->origin[a], hi = lo + g->dims[a] * g->cell;
+    reach = std::max(reach, std::max(std::abs(lo - origin[a]),
+        std::abs(hi - origin[a])));
+  }
+  reach *= std::sqrt(3.f);
+  const float margin = spread * reach;
+  for (int a = 0; a < 3; a++) {
+    const float lo = g->origin[a] - margin;
+    const float hi = g->origin[a] + g->dims[a] * g->cell + margin;
+    if (direction[a] == 0) {
+      if (origin[a] < lo || origin[a] > hi)
+        return false;
+      continue;
+    }
+    float a0 = (lo - origin[a]) / direction[a];
+    float a1 = (hi - origin[a]) / direction[a];
+    if (a0 > a1)
+      std::swap(a0, a1);
+    t0 = std::max(t0, a0);
+    t1 = std::min(t1, a1);
+  }
+  if (!(t0 <= t1))
+    return false;
+
+  // Spheres of a cell's length along the ray, widened by the cone. Steps
+  // are counted rather than summed up, which far from the origin could
+  // stop advancing t.
+  const float step = std::max(g->cell, (t1 - t0) / kMaxPickSteps);
+  const size_t steps = size_t((t1 - t0) / step) + 1;
+  float best = std::numeric_limits<float>::max();
+  bool any = false;
+  for (size_t k = 0; k < steps; k++) {
+    const float t = t0 + k * step;
+    if (t >= best)
+      break;
+    const float mid = t + step / 2;
+    const float center[3] = { origin[0] + direction[0] * mid,
+                              origin[1] + direction[1] * mid,
+                              origin[2] + direction[2] * mid };
+    const float radius = step / 2 + spread * (t + step);
+    within(*g, center, radius, [&](const indexed_point& q) {
+      const float v[3] = { q.x - origin[0], q.y - origin[1], q.z - origin[2] };
+      const float along = v[0] * direction[0] + v[1] * direction[1] +
+          v[2] * direction[2];
+      if (along <= 0 || along >= best)
+        return;
+      const float off = squared(v[0]) + squared(v[1]) + squared(v[2]) -
+          squared(along);
+      if (off <= squared(spread * along)) {
+        best = along;
+        any = true;
+        *found = q;
+        found->distance = along;
+      }
+    });
+  }
+  return any;
+}
+
+} // namespace glfw
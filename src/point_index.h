@@ -0,0 +1,94 @@
+/*
+ * point_index.h
+ *
+ */
+
+#ifndef POINT_INDEX_H_
+#define POINT_INDEX_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace glfw {
+
+// A point found by a query: its index into the vertices it was submitted
+// with, its position and its distance from the query point (from the ray
+// origin for picks)
+struct indexed_point {
+  uint32_t index;
+  float x, y, z;
+  float distance;
+};
+
+// Spatial index over the points of the latest frame, for picking and
+// measuring. Frames are copied on submit() and indexed on a thread of the
+// index's own, so neither drawing nor the worker pool waits for a build;
+// queries see the last frame that finished building. Points without depth
+// (z = 0) are left out.
+class point_index {
+ public:
+  point_index() = default;
+  ~point_index();
+
+  // Index count points of vertices (x, y, z); replaces a frame submitted
+  // earlier that is still waiting to be built
+  void submit(const float* vertices, size_t count);
+  // Drop the index and any frame waiting for it
+  void clear();
+
+  // The point nearest to (x, y, z), if one is within max_distance
+  bool nearest(const float p[3], float max_distance,
+               indexed_point* found) const;
+  // Call fn for every point within radius of p
+  void within(const float p[3], float radius,
+              const std::function<void(const indexed_point&)>& fn) const;
+  // The first point along the ray from origin in direction (unit length)
+  // that lies inside the cone of half angle atan(spread) around it
+  bool pick(const float origin[3], const float direction[3], float spread,
+            indexed_point* found) const;
+
+  // Points in the current index, and frames built so far
+  size_t size() const;
+  uint64_t builds() const;
+
+ private:
+  point_index(const point_index&) = delete;
+  point_index& operator=(const point_index&) = delete;
+
+  // Uniform grid, with the points sorted by cell
+  struct grid {
+    float origin[3] = { 0, 0, 0 };
+    float cell = 1;
+    int dims[3] = { 0, 0, 0 };
+    std::vector<uint32_t> cell_start;  // cells + 1
+    std::vector<uint32_t> index;
+    std::vector<float> points;         // x, y, z
+  };
+
+  static std::shared_ptr<grid> build(const std::vector<float>& vertices);
+  static void within(const grid& g, const float p[3], float radius,
+      const std::function<void(const indexed_point&)>& fn);
+  std::shared_ptr<const grid> current() const;
+  void builder_main();
+
+  mutable std::mutex mutex_;
+  std::condition_variable wake_;
+  std::thread builder_;
+  bool stop_ = false;
+  bool pending_ = false;
+  std::vector<float> frame_;  // waiting to be built
+  std::shared_ptr<const grid> grid_;
+  uint64_t builds_ = 0;
+  // Bumped by clear(), so that a build under way is thrown away
+  uint64_t epoch_ = 0;
+};
+
+} // namespace glfw
+
+#endif /* POINT_INDEX_H_ */
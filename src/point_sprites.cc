@@ -0,0 +1,140 @@
+/*
+ * point_sprites.cc
+ *
+ * The vertex shader sets gl_PointSize from the point's depth in its own
+ * frame (the spacing of the depth pixels there) and its distance from the
+ * eye. Circular sprites need the position inside the sprite, which GLSL
+ * 1.10 has no gl_PointCoord for; COORD_REPLACE on texture unit 1 puts it
+ * into gl_TexCoord[1] instead.
+ */
+
+#include "point_sprites.h"
+
+#include <algorithm>
+
+namespace glfw {
+
+namespace {
+
+const char* kSpriteVertexShader =
+    "#version 110\n"
+    "uniform float spacing_angle;\n"
+    "uniform float min_spacing;\n"
+    "uniform float pixels_per_unit;\n"
+    "void main() {\n"
+    "  vec4 eye = gl_ModelViewMatrix * gl_Vertex;\n"
+    "  gl_Position = gl_ProjectionMatrix * eye;\n"
+    "  gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+    "  gl_TexCoord[1] = vec4(0.0);\n"
+    "  gl_FrontColor = gl_Color;\n"
+    "  float spacing = max(gl_Vertex.z * spacing_angle, min_spacing);\n"
+    "  gl_PointSize = max(spacing * pixels_per_unit / max(-eye.z, 0.0001),\n"
+    "                     1.0);\n"
+    "}\n";
+
+const char* kSpriteFragmentShader =
+    "#version 110\n"
+    "uniform sampler2D color_tex;\n"
+    "uniform bool textured;\n"
+    "uniform bool circular;\n"
+    "void main() {\n"
+    "  if (circular) {\n"
+    "    vec2 d = gl_TexCoord[1].st * 2.0 - 1.0;\n"
+    "    if (dot(d, d) > 1.0)\n"
+    "      discard;\n"
+    "  }\n"
+    "  gl_FragColor = textured ?\n"
+    "      texture2D(color_tex, gl_TexCoord[0].st) * gl_Color : gl_Color;\n"
+    "}\n";
+
+point_sprite_settings settings;
+
+struct sprite_program {
+  ~sprite_program() {
+    if (program)
+      glDeleteProgram(program);
+  }
+
+  GLuint program = 0;
+  GLint spacing_angle, min_spacing, pixels_per_unit, textured, circular;
+  bool tried = false;
+};
+
+per_context<sprite_program> programs;
+
+const sprite_program& program() {
+  sprite_program& p = programs.current();
+  if (!p.tried) {
+    p.tried = true;
+    p.program = compile_program(kSpriteVertexShader, kSpriteFragmentShader);
+    if (p.program) {
+      glUseProgram(p.program);
+      glUniform1i(glGetUniformLocation(p.program, "color_tex"), 0);
+      p.spacing_angle = glGetUniformLocation(p.program, "spacing_angle");
+      p.min_spacing = glGetUniformLocation(p.program, "min_spacing");
+      p.pixels_per_unit = glGetUniformLocation(p.program, "pixels_per_unit");
+      p.textured = glGetUniformLocation(p.program, "textured");
+      p.circular = glGetUniformLocation(p.program, "circular");
+      glUseProgram(0);
+    }
+  }
+  return p;
+}
+
+} // namespace
+
+void set_point_sprites(const point_sprite_settings& s) {
+  settings = s;
+}
+
+const point_sprite_settings& point_sprite_options() {
+  return settings;
+}
+
+bool point_sprites_enabled() {
+  return settings.enabled && shaders_supported() && GLEW_VERSION_2_0 &&
+      program().program;
+}
+
+bool begin_point_sprites(float pixel_angle, float min_spacing) {
+  if (!point_sprites_enabled())
+    return false;
+  const sprite_program& p = program();
+
+  // Pixels across one unit at unit distance: half the viewport height
+  // times the cotangent of half the vertical field of view
+  GLfloat projection[16];
+  GLint viewport[4];
+  glGetFloatv(GL_PROJECTION_MATRIX, projection);
+  glGetIntegerv(GL_VIEWPORT, viewport);
+  // Like fixed function texturing, ignore a texture without an image
+  GLint texture_width = 0;
+  glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH,
+      &texture_width);
+
+  if (!pixel_angle)
+    pixel_angle = settings.pixel_angle;
+  glUseProgram(p.program);
+  glUniform1f(p.spacing_angle, std::max(pixel_angle, 0.f) * settings.scale);
+  glUniform1f(p.min_spacing, std::max(min_spacing, 0.f) * settings.scale);
+  glUniform1f(p.pixels_per_unit, projection[5] * viewport[3] / 2);
+  glUniform1i(p.textured, texture_width > 0);
+  glUniform1i(p.circular, settings.circular);
+  glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+  glEnable(GL_POINT_SPRITE);
+  glActiveTexture(GL_TEXTURE1);
+  glTexEnvi(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_TRUE);
+  glActiveTexture(GL_TEXTURE0);
+  return true;
+}
+
+void end_point_sprites() {
+  glActiveTexture(GL_TEXTURE1);
+  glTexEnvi(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_FALSE);
+  glActiveTexture(GL_TEXTURE0);
+  glDisable(GL_POINT_SPRITE);
+  glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+  glUseProgram(0);
+}
+
+} // namespace glfw
@@ -0,0 +1,41 @@
+/*
+ * point_sprites.h
+ *
+ */
+
+#ifndef POINT_SPRITES_H_
+#define POINT_SPRITES_H_
+
+#include "shader.h"
+
+namespace glfw {
+
+// Point clouds drawn as sprites sized by their depth instead of with one
+// glPointSize: each point covers the gap to its neighbours, which is its
+// depth times the angle between depth pixels (or the decimation voxel, if
+// larger), times scale, projected onto the screen. circular clips the
+// square sprites to discs.
+struct point_sprite_settings {
+  bool enabled = false;
+  float scale = 1;
+  // Radians between neighbouring depth pixels, 1 / fx
+  float pixel_angle = 1.f / 600;
+  bool circular = false;
+};
+
+void set_point_sprites(const point_sprite_settings& settings);
+const point_sprite_settings& point_sprite_options();
+// Enabled, and the context can draw them
+bool point_sprites_enabled();
+
+// Bind the sprite program for drawing points textured from unit 0 with the
+// current transforms and viewport. pixel_angle replaces the setting's when
+// positive, and when negative points are min_spacing wide whatever their
+// depth (voxels); otherwise they are at least min_spacing wide. Returns
+// false, and binds nothing, where sprites are off.
+bool begin_point_sprites(float pixel_angle, float min_spacing);
+void end_point_sprites();
+
+} // namespace glfw
+
+#endif /* POINT_SPRITES_H_ */
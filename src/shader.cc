@@ -0,0 +1,108 @@
+/*
+ * shader.cc
+ *
+ */
+
+#include "shader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+namespace glfw {
+
+namespace {
+
+std::vector<context_objects*>& all_kinds() {
+  static std::vector<context_objects*>* kinds =
+      new std::vector<context_objects*>();
+  return *kinds;
+}
+
+std::vector<GLFWwindow*>& used_contexts() {
+  static std::vector<GLFWwindow*>* contexts = new std::vector<GLFWwindow*>();
+  return *contexts;
+}
+
+GLuint compile_stage(GLenum type, const char* src) {
+  GLuint shader = glCreateShader(type);
+  glShaderSource(shader, 1, &src, nullptr);
+  glCompileShader(shader);
+
+  GLint ok = GL_FALSE;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+  if (!ok) {
+    GLint len = 0;
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &len);
+    std::vector<char> log(len + 1);
+    glGetShaderInfoLog(shader, len, nullptr, log.data());
+    fprintf(stderr, "glfw: shader compile failed: %s\n", log.data());
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+} // namespace
+
+bool shaders_supported() {
+  return GLEW_VERSION_2_0 != 0;
+}
+
+GLuint compile_program(const char* vertex_src, const char* fragment_src) {
+  if (!shaders_supported())
+    return 0;
+
+  GLuint vs = vertex_src ? compile_stage(GL_VERTEX_SHADER, vertex_src) : 0;
+  GLuint fs = fragment_src ? compile_stage(GL_FRAGMENT_SHADER, fragment_src) : 0;
+  if ((vertex_src && !vs) || (fragment_src && !fs)) {
+    if (vs) glDeleteShader(vs);
+    if (fs) glDeleteShader(fs);
+    return 0;
+  }
+
+  GLuint program = glCreateProgram();
+  if (vs) glAttachShader(program, vs);
+  if (fs) glAttachShader(program, fs);
+  glLinkProgram(program);
+  // The program keeps the stages alive for as long as it needs them
+  if (vs) glDeleteShader(vs);
+  if (fs) glDeleteShader(fs);
+
+  GLint ok = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &ok);
+  if (!ok) {
+    GLint len = 0;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &len);
+    std::vector<char> log(len + 1);
+    glGetProgramInfoLog(program, len, nullptr, log.data());
+    fprintf(stderr, "glfw: program link failed: %s\n", log.data());
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+context_objects::context_objects() {
+  all_kinds().push_back(this);
+}
+
+void context_objects::used_in(GLFWwindow* context) {
+  std::vector<GLFWwindow*>& contexts = used_contexts();
+  if (std::find(contexts.begin(), contexts.end(), context) == contexts.end())
+    contexts.push_back(context);
+}
+
+void release_context_objects(GLFWwindow* context) {
+  for (context_objects* kind : all_kinds())
+    kind->release(context);
+  std::vector<GLFWwindow*>& contexts = used_contexts();
+  contexts.erase(std::remove(contexts.begin(), contexts.end(), context),
+      contexts.end());
+}
+
+std::vector<GLFWwindow*> contexts_with_objects() {
+  return used_contexts();
+}
+
+} // namespace glfw
@@ -0,0 +1,70 @@
+/*
+ * shader.h
+ *
+ */
+
+#ifndef SHADER_H_
+#define SHADER_H_
+
+#ifndef GLEW_STATIC
+#define GLEW_STATIC
+#endif
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <map>
+#include <vector>
+
+namespace glfw {
+
+// True once the current context can run GLSL programs
+bool shaders_supported();
+
+// Compile and link a program; either stage may be null to keep the fixed
+// function one. Returns 0 and logs to stderr on failure.
+GLuint compile_program(const char* vertex_src, const char* fragment_src);
+
+class context_objects {
+ public:
+  virtual void release(GLFWwindow* context) = 0;
+
+ protected:
+  context_objects();
+  ~context_objects() {}
+  // Record that context has objects to release
+  static void used_in(GLFWwindow* context);
+};
+
+// GL objects of one kind kept for each context, since windows do not share
+// contexts and names made in one mean nothing in another. The T of the
+// current context is made on first use and destroyed, with its context
+// current, by release_context_objects(); its destructor deletes what it
+// holds. Instances live at namespace scope.
+template <typename T>
+class per_context : public context_objects {
+ public:
+  T& current() {
+    GLFWwindow* context = glfwGetCurrentContext();
+    if (!objects_.count(context))
+      used_in(context);
+    return objects_[context];
+  }
+
+  void release(GLFWwindow* context) override {
+    objects_.erase(context);
+  }
+
+ private:
+  // Never destroyed: at exit there may be no context left to release the
+  // objects in, and whatever contexts remain go with the process
+  std::map<GLFWwindow*, T>& objects_ = *new std::map<GLFWwindow*, T>();
+};
+
+// Destroy the objects kept for context, which must be current
+void release_context_objects(GLFWwindow* context);
+// Contexts that objects were kept for since they were last released
+std::vector<GLFWwindow*> contexts_with_objects();
+
+} // namespace glfw
+
+#endif /* SHADER_H_ */
@@ -0,0 +1,388 @@
+/*
+ * texture_upload.cc
+ *
+ */
+
+#include "texture_upload.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <map>
+
+namespace glfw {
+
+namespace {
+
+// Longest a single upload will wait for its buffer to be released
+const GLuint64 kFenceTimeoutNs = 1000000000;
+const unsigned kMaxRingDepth = 8;
+
+struct ring_slot {
+  GLuint buffer = 0;
+  GLsync fence = nullptr;
+};
+
+struct texture_storage {
+  GLsizei width = 0, height = 0;
+  GLenum internal_format = 0;
+  // Pixel unpack buffers used round robin while streaming
+  std::vector<ring_slot> ring;
+  GLsizeiptr ring_bytes = 0;
+  size_t next = 0;
+};
+
+unsigned ring_depth = 0;
+streaming_stats stats;
+std::vector<upload_buffer*> upload_buffers;
+
+struct cached_frame {
+  frame_key key;
+  unsigned long generation;
+};
+
+unsigned long frame_generation = 0;
+frame_cache_stats cache_stats;
+
+size_t pixel_bytes(GLenum format, GLenum type) {
+  size_t components = 1;
+  switch (format) {
+    case GL_LUMINANCE_ALPHA: case GL_RG: components = 2; break;
+    case GL_RGB: case GL_BGR: components = 3; break;
+    case GL_RGBA: case GL_BGRA: components = 4; break;
+  }
+  switch (type) {
+    case GL_UNSIGNED_SHORT: case GL_SHORT: return components * 2;
+    case GL_UNSIGNED_INT: case GL_INT: case GL_FLOAT: return components * 4;
+    default: return components;
+  }
+}
+
+// Bytes glTexSubImage2D reads for an image under the current unpack state
+GLsizeiptr image_bytes(GLsizei width, GLsizei height,
+                       GLenum format, GLenum type) {
+  GLint alignment = 4, row_length = 0, skip_pixels = 0, skip_rows = 0;
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+  glGetIntegerv(GL_UNPACK_ROW_LENGTH, &row_length);
+  glGetIntegerv(GL_UNPACK_SKIP_PIXELS, &skip_pixels);
+  glGetIntegerv(GL_UNPACK_SKIP_ROWS, &skip_rows);
+  const size_t pixel = pixel_bytes(format, type);
+  const size_t row = size_t(row_length ? row_length : width) * pixel;
+  const size_t stride = (row + alignment - 1) / alignment * alignment;
+  return GLsizeiptr(stride * (skip_rows + height - 1) +
+      (skip_pixels + width) * pixel);
+}
+
+bool pixel_buffers_supported() {
+  return GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object;
+}
+
+bool streaming_supported() {
+  return pixel_buffers_supported() && GLEW_ARB_map_buffer_range &&
+      GLEW_ARB_sync;
+}
+
+void release_ring(texture_storage& t) {
+  for (ring_slot& slot : t.ring) {
+    if (slot.fence)
+      glDeleteSync(slot.fence);
+    glDeleteBuffers(1, &slot.buffer);
+  }
+  t.ring.clear();
+  t.ring_bytes = 0;
+  t.next = 0;
+}
+
+// What is known about the textures of a context and the frames they hold
+struct texture_objects {
+  ~texture_objects();
+
+  std::map<GLuint, texture_storage> storage;
+  std::map<std::pair<GLuint, unsigned>, cached_frame> frames;
+};
+
+texture_objects::~texture_objects() {
+  for (auto& t : storage)
+    release_ring(t.second);
+}
+
+per_context<texture_objects> objects;
+
+// Wait until the GPU has passed fence and delete it. ms is the time spent
+// blocking, or negative if the fence had already signaled. Returns false,
+// keeping the fence, if it did not signal within kFenceTimeoutNs or the wait
+// failed: what it guards may still be in use.
+bool wait_for(GLsync& fence, double& ms) {
+  ms = -1;
+  if (!fence)
+    return true;
+  GLenum status = glClientWaitSync(fence, 0, 0);
+  if (status == GL_TIMEOUT_EXPIRED) {
+    auto start = std::chrono::steady_clock::now();
+    status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+        kFenceTimeoutNs);
+    ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+  }
+  if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+    return false;
+  glDeleteSync(fence);
+  fence = nullptr;
+  return true;
+}
+
+// Copy pixels into the next buffer of the ring and have the driver transfer
+// them from there, so the copy to the texture overlaps with rendering.
+// Returns false, having uploaded nothing, if the buffer is still in use or
+// could not be mapped.
+bool stream(texture_storage& t, GLsizei width, GLsizei height,
+            GLenum format, GLenum type, const void* pixels) {
+  GLsizeiptr bytes = image_bytes(width, height, format, type);
+  if (t.ring.size() != ring_depth || t.ring_bytes != bytes) {
+    release_ring(t);
+    t.ring.resize(ring_depth);
+    t.ring_bytes = bytes;
+    for (ring_slot& slot : t.ring) {
+      glGenBuffers(1, &slot.buffer);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    }
+  }
+
+  ring_slot& slot = t.ring[t.next];
+  t.next = (t.next + 1) % t.ring.size();
+  double waited;
+  const bool idle = wait_for(slot.fence, waited);
+  if (waited >= 0) {
+    stats.fence_waits++;
+    stats.fence_wait_ms += waited;
+  }
+  if (!idle)
+    return false;
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+  // The fence has signaled, so the buffer is idle
+  void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT |
+      GL_MAP_UNSYNCHRONIZED_BIT);
+  bool ok = mapped != nullptr;
+  if (ok) {
+    memcpy(mapped, pixels, bytes);
+    ok = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+  }
+  if (ok) {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type,
+        nullptr);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    stats.uploads++;
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  return ok;
+}
+
+} // namespace
+
+void upload_texture_image(GLuint texture, GLenum internal_format,
+                          GLsizei width, GLsizei height,
+                          GLenum format, GLenum type, const void* pixels) {
+  texture_storage& t = objects.current().storage[texture];
+  glBindTexture(GL_TEXTURE_2D, texture);
+  bool streaming = ring_depth && streaming_supported();
+  if (!streaming && !t.ring.empty())
+    release_ring(t);
+  size_t bytes = 0;
+  upload_buffer* source = nullptr;
+  if (!upload_buffers.empty()) {
+    bytes = image_bytes(width, height, format, type);
+    source = upload_buffer::holding(pixels, bytes);
+  }
+
+  if (t.width != width || t.height != height ||
+      t.internal_format != internal_format) {
+    // Mutable storage: callers keep their texture names across changes of
+    // stream geometry, and immutable storage could not be respecified.
+    t.width = width;
+    t.height = height;
+    t.internal_format = internal_format;
+    if (streaming || source) {
+      glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0,
+          format, type, nullptr);
+    } else {
+      glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0,
+          format, type, pixels);
+      return;
+    }
+  }
+  if (source && source->upload(width, height, format, type, pixels, bytes))
+    return;
+  if (streaming && stream(t, width, height, format, type, pixels))
+    return;
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type,
+      pixels);
+}
+
+unpack_layout::unpack_layout(const frame_layout& layout,
+                             unsigned texel_bytes) {
+  if (layout.packed())
+    return;
+  set_ = true;
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment_);
+  // The stride is in bytes and need not be a multiple of 4
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, layout.stride / texel_bytes);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, layout.x);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, layout.y);
+}
+
+unpack_layout::~unpack_layout() {
+  if (!set_)
+    return;
+  glPixelStorei(GL_UNPACK_ALIGNMENT, alignment_);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+}
+
+void forget_texture_storage(GLuint texture) {
+  std::map<GLuint, texture_storage>& storage = objects.current().storage;
+  auto it = storage.find(texture);
+  if (it == storage.end())
+    return;
+  release_ring(it->second);
+  storage.erase(it);
+}
+
+void set_texture_streaming(unsigned depth) {
+  ring_depth = depth < kMaxRingDepth ? depth : kMaxRingDepth;
+}
+
+unsigned texture_streaming() {
+  return streaming_supported() ? ring_depth : 0;
+}
+
+streaming_stats texture_streaming_stats() {
+  streaming_stats s = stats;
+  s.ring_depth = texture_streaming();
+  return s;
+}
+
+bool frame_cached(GLuint texture, const frame_key& key, unsigned region) {
+  cached_frame& c = objects.current().frames[{ texture, region }];
+  if (c.generation == frame_generation && c.key.frame == key.frame &&
+      c.key.format == key.format && c.key.width == key.width &&
+      c.key.height == key.height && c.key.source == key.source &&
+      c.key.layout.stride == key.layout.stride &&
+      c.key.layout.x == key.layout.x && c.key.layout.y == key.layout.y) {
+    cache_stats.hits++;
+    return true;
+  }
+  c.key = key;
+  c.generation = frame_generation;
+  cache_stats.misses++;
+  return false;
+}
+
+void forget_frame(GLuint texture, unsigned region) {
+  std::map<std::pair<GLuint, unsigned>, cached_frame>& frames =
+      objects.current().frames;
+  if (region != kAllRegions) {
+    frames.erase({ texture, region });
+    return;
+  }
+  frames.erase(frames.lower_bound({ texture, 0 }),
+      frames.upper_bound({ texture, kAllRegions }));
+}
+
+void invalidate_frames() {
+  frame_generation++;
+}
+
+frame_cache_stats frame_cache_statistics() {
+  return cache_stats;
+}
+
+upload_buffer::upload_buffer(size_t bytes)
+    : memory_(bytes), data_(memory_.data()), size_(bytes) {
+  if (pixel_buffers_supported()) {
+    glGenBuffers(1, &buffer_);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer_);
+    if (GLEW_ARB_buffer_storage && GLEW_ARB_sync) {
+      const GLbitfield flags =
+          GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      glBufferStorage(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, flags);
+      mapped_ = static_cast<uint8_t*>(
+          glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, flags));
+      persistent_ = mapped_ != nullptr;
+    } else {
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+  upload_buffers.push_back(this);
+}
+
+upload_buffer::~upload_buffer() {
+  upload_buffers.erase(
+      std::find(upload_buffers.begin(), upload_buffers.end(), this));
+  release();
+}
+
+void upload_buffer::release() {
+  if (fence_)
+    glDeleteSync(fence_);
+  fence_ = nullptr;
+  if (persistent_) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer_);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    persistent_ = false;
+    mapped_ = nullptr;
+  }
+  if (buffer_)
+    glDeleteBuffers(1, &buffer_);
+  buffer_ = 0;
+}
+
+double upload_buffer::wait() {
+  double ms;
+  wait_for(fence_, ms);
+  return ms > 0 ? ms : 0;
+}
+
+upload_buffer* upload_buffer::holding(const void* pixels, size_t bytes) {
+  const uint8_t* p = static_cast<const uint8_t*>(pixels);
+  for (upload_buffer* b : upload_buffers) {
+    if (p >= b->data_ && bytes <= b->size_ &&
+        size_t(p - b->data_) <= b->size_ - bytes)
+      return b;
+  }
+  return nullptr;
+}
+
+bool upload_buffer::upload(GLsizei width, GLsizei height, GLenum format,
+                           GLenum type, const void* pixels, size_t bytes) {
+  if (!buffer_)
+    return false;
+  size_t offset = static_cast<const uint8_t*>(pixels) - data_;
+  if (persistent_) {
+    // The mapping is only rewritten once the GPU has read the last upload
+    double ms;
+    if (!wait_for(fence_, ms))
+      return false;
+    memcpy(mapped_ + offset, pixels, bytes);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer_);
+  if (!persistent_)
+    glBufferSubData(GL_PIXEL_UNPACK_BUFFER, offset, bytes, pixels);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type,
+      reinterpret_cast<const void*>(offset));
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  if (GLEW_ARB_sync) {
+    if (fence_)
+      glDeleteSync(fence_);
+    fence_ = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+  return true;
+}
+
+} // namespace glfw
@@ -0,0 +1,146 @@
+/*
+ * texture_upload.h
+ *
+ */
+
+#ifndef TEXTURE_UPLOAD_H_
+#define TEXTURE_UPLOAD_H_
+
+#include "pixel_format.h"
+#include "shader.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace glfw {
+
+// Upload a full image into texture, leaving it bound to GL_TEXTURE_2D.
+// Storage is only (re)allocated, with glTexImage2D, when the size or internal
+// format differs from the previous upload; otherwise the pixels go in with
+// glTexSubImage2D.
+void upload_texture_image(GLuint texture, GLenum internal_format,
+                          GLsizei width, GLsizei height,
+                          GLenum format, GLenum type, const void* pixels);
+
+// Point GL_UNPACK_ROW_LENGTH, GL_UNPACK_SKIP_PIXELS and GL_UNPACK_SKIP_ROWS
+// at layout for as long as the object lives, so the next uploads read the
+// frame straight from its buffer. texel_bytes is the size of one texel as
+// handed to GL.
+class unpack_layout {
+ public:
+  unpack_layout(const frame_layout& layout, unsigned texel_bytes);
+  ~unpack_layout();
+
+ private:
+  unpack_layout(const unpack_layout&) = delete;
+  unpack_layout& operator=(const unpack_layout&) = delete;
+
+  bool set_ = false;
+  GLint alignment_ = 4;
+};
+
+// Drop what is known about texture's storage, e.g. after deleting it
+void forget_texture_storage(GLuint texture);
+
+// Route uploads through a ring of depth pixel unpack buffers per texture,
+// fenced so that a buffer is only rewritten once the GPU has read it.
+// 0 uploads directly from the caller's memory. Needs GL_ARB_sync and
+// GL_ARB_map_buffer_range; without them uploads stay direct.
+void set_texture_streaming(unsigned depth);
+unsigned texture_streaming();
+
+struct streaming_stats {
+  unsigned ring_depth = 0;
+  unsigned long uploads = 0;
+  // Uploads that found their buffer still in use, and the time spent on them
+  unsigned long fence_waits = 0;
+  double fence_wait_ms = 0;
+};
+
+streaming_stats texture_streaming_stats();
+
+// Frame identity cache: callers that number (or timestamp) their frames
+// skip uploading, and colorizing, a frame a texture already holds.
+const double kNoFrame = std::numeric_limits<double>::quiet_NaN();
+
+struct frame_key {
+  double frame;
+  pixel_format format;
+  uint32_t width, height;
+  // The buffer the frame is read from and the crop of it. Frame numbers are
+  // only unique within a stream, and textures may be shared by several.
+  const void* source;
+  frame_layout layout;
+};
+
+// Textures holding several frames (atlases) track each region on its own
+const unsigned kAllRegions = ~0u;
+
+// True if texture (or the region of it) already holds this frame. Otherwise
+// remembers key as what it is about to hold and returns false.
+bool frame_cached(GLuint texture, const frame_key& key, unsigned region = 0);
+// The contents no longer match what was recorded for them
+void forget_frame(GLuint texture, unsigned region = kAllRegions);
+// Settings that change how frames look (colormaps, colorization mode)
+// changed, so nothing cached may be reused
+void invalidate_frames();
+
+struct frame_cache_stats {
+  unsigned long hits = 0, misses = 0;
+};
+
+frame_cache_stats frame_cache_statistics();
+
+// Memory that frames can be written into and uploaded from through a pixel
+// buffer of their own. data() is plain memory owned by the object, so it
+// stays valid when the GL objects go; with GL_ARB_buffer_storage uploads are
+// staged into a persistently mapped pixel unpack buffer, fenced so that it
+// is only rewritten once the GPU has read it, and otherwise copied into the
+// buffer with glBufferSubData. Any upload_texture_image() whose pixels lie
+// inside data() goes through the buffer.
+// Must be destroyed in the context it was made in, or released there first.
+class upload_buffer {
+ public:
+  explicit upload_buffer(size_t bytes);
+  ~upload_buffer();
+
+  uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool persistent() const { return persistent_; }
+  // Whether there are GL objects left to delete
+  bool has_buffer() const { return buffer_ != 0; }
+
+  // Delete the GL objects now, e.g. before the context goes away. data()
+  // stays valid; uploads from it go on without the pixel buffer.
+  void release();
+
+  // Block until the GPU has read the last upload, for at most a second;
+  // returns milliseconds spent
+  double wait();
+
+  // The live buffer holding [pixels, pixels + bytes), if any
+  static upload_buffer* holding(const void* pixels, size_t bytes);
+
+  // glTexSubImage2D into the bound texture from the buffer. False if the
+  // context has no pixel buffers or the mapping is still being read.
+  bool upload(GLsizei width, GLsizei height, GLenum format, GLenum type,
+              const void* pixels, size_t bytes);
+
+ private:
+  upload_buffer(const upload_buffer&) = delete;
+  upload_buffer& operator=(const upload_buffer&) = delete;
+
+  std::vector<uint8_t> memory_;
+  uint8_t* data_;
+  size_t size_;
+  GLuint buffer_ = 0;
+  GLsync fence_ = nullptr;
+  uint8_t* mapped_ = nullptr;
+  bool persistent_ = false;
+};
+
+} // namespace glfw
+
+#endif /* TEXTURE_UPLOAD_H_ */
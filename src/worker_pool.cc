@@ -0,0 +1,103 @@
+/*
+ * worker_pool.cc
+ *
+ */
+
+#include "worker_pool.h"
+
+#include <algorithm>
+
+namespace glfw {
+
+worker_pool& worker_pool::instance() {
+  static worker_pool pool;
+  return pool;
+}
+
+worker_pool::~worker_pool() {
+  stop_workers();
+}
+
+unsigned worker_pool::max_size() {
+  return 4 * std::max(1u, std::thread::hardware_concurrency());
+}
+
+void worker_pool::resize(unsigned threads) {
+  if (!threads) threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min(threads, max_size());
+
+  std::lock_guard<std::mutex> serial(run_mutex_);
+  if (threads == size()) return;
+  stop_workers();
+  stop_ = false;
+  for (unsigned i = 1; i < threads; ++i)
+    workers_.emplace_back(&worker_pool::worker_main, this);
+}
+
+void worker_pool::run(unsigned tasks,
+                      const std::function<void(unsigned)>& fn) {
+  std::lock_guard<std::mutex> serial(run_mutex_);
+  if (workers_.empty() || tasks <= 1) {
+    for (unsigned t = 0; t < tasks; ++t) fn(t);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fn_ = &fn;
+    tasks_ = tasks;
+    finished_ = 0;
+    next_ = 0;
+    ++generation_;
+  }
+  wake_.notify_all();
+
+  unsigned completed = drain(fn, tasks);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  finished_ += completed;
+  // Wait for stragglers too, so none of them can pick up the next job's
+  // indices with this job's function.
+  done_.wait(lock, [&] { return finished_ == tasks_ && active_ == 0; });
+  fn_ = nullptr;
+}
+
+unsigned worker_pool::drain(const std::function<void(unsigned)>& fn,
+                            unsigned tasks) {
+  unsigned completed = 0;
+  for (unsigned t; (t = next_.fetch_add(1)) < tasks; ++completed) fn(t);
+  return completed;
+}
+
+void worker_pool::worker_main() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  unsigned long seen = generation_;
+  for (;;) {
+    wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+    if (stop_) return;
+    seen = generation_;
+    if (!fn_) continue;
+
+    const std::function<void(unsigned)>& fn = *fn_;
+    unsigned tasks = tasks_;
+    ++active_;
+    lock.unlock();
+    unsigned completed = drain(fn, tasks);
+    lock.lock();
+    finished_ += completed;
+    --active_;
+    if (finished_ == tasks_ && active_ == 0) done_.notify_one();
+  }
+}
+
+void worker_pool::stop_workers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto& t : workers_) t.join();
+  workers_.clear();
+}
+
+} // namespace glfw
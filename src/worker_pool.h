@@ -0,0 +1,61 @@
+/*
+ * worker_pool.h
+ *
+ */
+
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace glfw {
+
+// Fixed set of native threads used to split per-frame work into bands.
+// The calling thread always takes part, so a pool of size 1 runs inline.
+class worker_pool {
+ public:
+  static worker_pool& instance();
+
+  ~worker_pool();
+
+  // Total number of threads, including the caller. 0 picks one per core;
+  // more than max_size() are capped.
+  void resize(unsigned threads);
+  // Four per core
+  static unsigned max_size();
+  unsigned size() const { return unsigned(workers_.size()) + 1; }
+
+  // Call fn(0) .. fn(tasks - 1) across the pool and return once all are done.
+  void run(unsigned tasks, const std::function<void(unsigned)>& fn);
+
+ private:
+  worker_pool() {}
+  worker_pool(const worker_pool&) = delete;
+  worker_pool& operator=(const worker_pool&) = delete;
+
+  void stop_workers();
+  void worker_main();
+  unsigned drain(const std::function<void(unsigned)>& fn, unsigned tasks);
+
+  std::vector<std::thread> workers_;
+  std::mutex run_mutex_;  // one job at a time
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  const std::function<void(unsigned)>* fn_ = nullptr;
+  unsigned tasks_ = 0;
+  unsigned finished_ = 0;
+  unsigned active_ = 0;
+  unsigned long generation_ = 0;
+  bool stop_ = false;
+  std::atomic<unsigned> next_{0};
+};
+
+} // namespace glfw
+
+#endif /* WORKER_POOL_H_ */
@@ -0,0 +1,429 @@
+/*
+ * yuv.cc
+ *
+ * YUV frames are uploaded as they arrive and converted to RGB (BT.601,
+ * limited range) in a fragment shader. Packed 4:2:2 frames go into an RGBA
+ * texture of half the width, one texel per pair of pixels; planar 4:2:0
+ * frames into a luma texture plus a chroma texture. I420 keeps U and V
+ * stacked in one texture, since the two planes are adjacent in the frame.
+ *
+ * Without shaders frames are converted on the CPU, in 6-bit fixed point so
+ * that the SSE2 and NEON versions produce the same bytes as the scalar one.
+ */
+
+#include "yuv.h"
+#include "texture_upload.h"
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <string>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define YUV_SSE2 1
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define YUV_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace glfw {
+
+namespace {
+
+const size_t kMinBandPixels = 0x10000;
+
+const char* kYuvFragmentShader =
+    "uniform sampler2D luma_tex;\n"
+    "uniform sampler2D chroma_tex;\n"
+    "uniform float texels;\n"
+    "vec3 to_rgb(vec3 yuv) {\n"
+    "  yuv = yuv * 255.0 - vec3(16.0, 128.0, 128.0);\n"
+    "  return vec3(75.0 * yuv.x + 102.0 * yuv.z,\n"
+    "              75.0 * yuv.x - 25.0 * yuv.y - 52.0 * yuv.z,\n"
+    "              75.0 * yuv.x + 129.0 * yuv.y) / (64.0 * 255.0);\n"
+    "}\n"
+    "void main() {\n"
+    "  vec2 st = gl_TexCoord[0].st;\n"
+    "#if defined(YUYV) || defined(UYVY)\n"
+    "  vec4 t = texture2D(luma_tex, st);\n"
+    "  float odd = step(0.5, fract(st.s * texels));\n"
+    "#ifdef YUYV\n"
+    "  vec3 yuv = vec3(mix(t.r, t.b, odd), t.g, t.a);\n"
+    "#else\n"
+    "  vec3 yuv = vec3(mix(t.g, t.a, odd), t.r, t.b);\n"
+    "#endif\n"
+    "#elif defined(NV12)\n"
+    "  vec4 c = texture2D(chroma_tex, st);\n"
+    "  vec3 yuv = vec3(texture2D(luma_tex, st).r, c.r, c.a);\n"
+    "#else\n"
+    "  vec3 yuv = vec3(texture2D(luma_tex, st).r,\n"
+    "      texture2D(chroma_tex, vec2(st.s, st.t * 0.5)).r,\n"
+    "      texture2D(chroma_tex, vec2(st.s, 0.5 + st.t * 0.5)).r);\n"
+    "#endif\n"
+    "  gl_FragColor = vec4(to_rgb(yuv), 1.0) * gl_Color;\n"
+    "}\n";
+
+struct yuv_texture {
+  pixel_format format = PIXEL_FORMAT_UNKNOWN;
+  GLuint chroma_texture = 0;
+  // Texels per row of a packed frame
+  float texels = 0;
+};
+
+struct yuv_program {
+  GLuint program = 0;
+  GLint texels = -1;
+  bool tried = false;
+};
+
+// The programs and the chroma textures of the YUV textures of a context
+struct yuv_objects {
+  ~yuv_objects();
+
+  yuv_program programs[PIXEL_FORMAT_COUNT];
+  std::map<GLuint, yuv_texture> textures;
+};
+
+// What texture_upload knows of the chroma textures goes with the context
+yuv_objects::~yuv_objects() {
+  for (auto& t : textures) {
+    if (t.second.chroma_texture)
+      glDeleteTextures(1, &t.second.chroma_texture);
+  }
+  for (const yuv_program& p : programs) {
+    if (p.program)
+      glDeleteProgram(p.program);
+  }
+}
+
+per_context<yuv_objects> objects;
+
+std::map<GLuint, yuv_texture>& textures() {
+  return objects.current().textures;
+}
+
+yuv_program& program_for(pixel_format format) {
+  yuv_program& p = objects.current().programs[format];
+  if (!p.tried) {
+    p.tried = true;
+    std::string name = format_traits(format).name;
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    std::string source = "#version 110\n#define " + name + "\n" +
+        kYuvFragmentShader;
+    p.program = compile_program(nullptr, source.c_str());
+    if (p.program) {
+      glUseProgram(p.program);
+      glUniform1i(glGetUniformLocation(p.program, "luma_tex"), 0);
+      glUniform1i(glGetUniformLocation(p.program, "chroma_tex"), 1);
+      p.texels = glGetUniformLocation(p.program, "texels");
+      glUseProgram(0);
+    }
+  }
+  return p;
+}
+
+void set_filter(GLenum filter) {
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+// One row of a frame: luma of pixel i at y[i * y_step], chroma of pixels
+// 2j and 2j + 1 at u[j * c_step] and v[j * c_step]
+struct yuv_row {
+  const uint8_t* y;
+  const uint8_t* u;
+  const uint8_t* v;
+  int y_step, c_step;
+};
+
+inline uint8_t channel(int x) {
+  x = (x + 32) >> 6;
+  return uint8_t(x < 0 ? 0 : x > 255 ? 255 : x);
+}
+
+inline void put_rgba(uint8_t* p, int y, int u, int v) {
+  const int l = (y - 16) * 75;
+  u -= 128;
+  v -= 128;
+  p[0] = channel(l + 102 * v);
+  p[1] = channel(l - 25 * u - 52 * v);
+  p[2] = channel(l + 129 * u);
+  p[3] = 255;
+}
+
+void convert_row_scalar(uint8_t* rgba, const yuv_row& r, int begin, int end) {
+  for (int i = begin; i < end; i++) {
+    const int j = i >> 1;
+    put_rgba(rgba + i * 4, r.y[i * r.y_step], r.u[j * r.c_step],
+        r.v[j * r.c_step]);
+  }
+}
+
+#if YUV_SSE2
+// Eight pixels from 16-bit luma and [U V U V ...] chroma lanes
+inline void convert8(uint8_t* rgba, __m128i y, __m128i c) {
+  const __m128i low = _mm_set1_epi32(0xFFFF);
+  const __m128i u1 = _mm_and_si128(c, low);
+  const __m128i v1 = _mm_srli_epi32(c, 16);
+  const __m128i u = _mm_sub_epi16(
+      _mm_or_si128(u1, _mm_slli_epi32(u1, 16)), _mm_set1_epi16(128));
+  const __m128i v = _mm_sub_epi16(
+      _mm_or_si128(v1, _mm_slli_epi32(v1, 16)), _mm_set1_epi16(128));
+  const __m128i l = _mm_mullo_epi16(
+      _mm_sub_epi16(y, _mm_set1_epi16(16)), _mm_set1_epi16(75));
+  const __m128i half = _mm_set1_epi16(32);
+
+  // Only blue can leave the 16-bit range, and saturating keeps it above 255
+  __m128i r = _mm_adds_epi16(l, _mm_mullo_epi16(v, _mm_set1_epi16(102)));
+  __m128i g = _mm_sub_epi16(_mm_sub_epi16(l,
+      _mm_mullo_epi16(u, _mm_set1_epi16(25))),
+      _mm_mullo_epi16(v, _mm_set1_epi16(52)));
+  __m128i b = _mm_adds_epi16(l, _mm_mullo_epi16(u, _mm_set1_epi16(129)));
+  r = _mm_srai_epi16(_mm_adds_epi16(r, half), 6);
+  g = _mm_srai_epi16(_mm_adds_epi16(g, half), 6);
+  b = _mm_srai_epi16(_mm_adds_epi16(b, half), 6);
+
+  const __m128i r8 = _mm_packus_epi16(r, r);
+  const __m128i g8 = _mm_packus_epi16(g, g);
+  const __m128i b8 = _mm_packus_epi16(b, b);
+  const __m128i rg = _mm_unpacklo_epi8(r8, g8);
+  const __m128i ba = _mm_unpacklo_epi8(b8, _mm_set1_epi8(-1));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba),
+      _mm_unpacklo_epi16(rg, ba));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + 16),
+      _mm_unpackhi_epi16(rg, ba));
+}
+
+void convert_row(uint8_t* rgba, const yuv_row& r, int width) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i low = _mm_set1_epi16(0xFF);
+  int i = 0;
+  for (; i + 8 <= width; i += 8) {
+    __m128i y, c;
+    if (r.y_step == 2) {
+      // Packed: luma in every other byte, chroma in the bytes between
+      const uint8_t* p = std::min(r.y, r.u) + i * 2;
+      const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      const __m128i even = _mm_and_si128(x, low);
+      const __m128i odd = _mm_srli_epi16(x, 8);
+      const bool luma_first = r.y < r.u;
+      y = luma_first ? even : odd;
+      c = luma_first ? odd : even;
+    } else {
+      y = _mm_unpacklo_epi8(
+          _mm_loadl_epi64(reinterpret_cast<const __m128i*>(r.y + i)), zero);
+      if (r.c_step == 2) {
+        c = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(r.u + i));
+      } else {
+        int32_t u4, v4;
+        memcpy(&u4, r.u + i / 2, 4);
+        memcpy(&v4, r.v + i / 2, 4);
+        c = _mm_unpacklo_epi8(_mm_cvtsi32_si128(u4), _mm_cvtsi32_si128(v4));
+      }
+      c = _mm_unpacklo_epi8(c, zero);
+    }
+    convert8(rgba + i * 4, y, c);
+  }
+  convert_row_scalar(rgba, r, i, width);
+}
+
+const char* const kKernelName = "sse2";
+#elif YUV_NEON
+inline uint8x8_t channel8(int16x8_t x) {
+  return vqrshrun_n_s16(x, 6);
+}
+
+// Eight pixels from 8-bit luma and [U V U V ...] chroma
+inline void convert8(uint8_t* rgba, uint8x8_t y8, uint8x8_t c8) {
+  const uint8x8x2_t uv = vuzp_u8(c8, c8);
+  const int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(
+      vmovl_u8(vzip_u8(uv.val[0], uv.val[0]).val[0])), vdupq_n_s16(128));
+  const int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(
+      vmovl_u8(vzip_u8(uv.val[1], uv.val[1]).val[0])), vdupq_n_s16(128));
+  const int16x8_t l = vmulq_n_s16(vsubq_s16(
+      vreinterpretq_s16_u16(vmovl_u8(y8)), vdupq_n_s16(16)), 75);
+
+  uint8x8x4_t out;
+  out.val[0] = channel8(vqaddq_s16(l, vmulq_n_s16(v, 102)));
+  out.val[1] = channel8(vsubq_s16(vsubq_s16(l, vmulq_n_s16(u, 25)),
+      vmulq_n_s16(v, 52)));
+  out.val[2] = channel8(vqaddq_s16(l, vmulq_n_s16(u, 129)));
+  out.val[3] = vdup_n_u8(255);
+  vst4_u8(rgba, out);
+}
+
+void convert_row(uint8_t* rgba, const yuv_row& r, int width) {
+  int i = 0;
+  for (; i + 8 <= width; i += 8) {
+    uint8x8_t y, c;
+    if (r.y_step == 2) {
+      const bool luma_first = r.y < r.u;
+      const uint8x8x2_t x = vld2_u8(std::min(r.y, r.u) + i * 2);
+      y = luma_first ? x.val[0] : x.val[1];
+      c = luma_first ? x.val[1] : x.val[0];
+    } else {
+      y = vld1_u8(r.y + i);
+      if (r.c_step == 2) {
+        c = vld1_u8(r.u + i);
+      } else {
+        uint32_t u4, v4;
+        memcpy(&u4, r.u + i / 2, 4);
+        memcpy(&v4, r.v + i / 2, 4);
+        c = vzip_u8(vreinterpret_u8_u32(vdup_n_u32(u4)),
+            vreinterpret_u8_u32(vdup_n_u32(v4))).val[0];
+      }
+    }
+    convert8(rgba + i * 4, y, c);
+  }
+  convert_row_scalar(rgba, r, i, width);
+}
+
+const char* const kKernelName = "neon";
+#else
+void convert_row(uint8_t* rgba, const yuv_row& r, int width) {
+  convert_row_scalar(rgba, r, 0, width);
+}
+
+const char* const kKernelName = "scalar";
+#endif
+
+yuv_row frame_row(const uint8_t* data, int width, int height,
+                  pixel_format format, size_t stride, int row) {
+  const size_t luma = size_t(width) * height;
+  const uint8_t* y = data + size_t(row) * width;
+  switch (format) {
+    case PIXEL_FORMAT_YUYV: {
+      const uint8_t* p = data + row * stride;
+      return { p, p + 1, p + 3, 2, 4 };
+    }
+    case PIXEL_FORMAT_UYVY: {
+      const uint8_t* p = data + row * stride;
+      return { p + 1, p, p + 2, 2, 4 };
+    }
+    case PIXEL_FORMAT_NV12: {
+      const uint8_t* uv = data + luma + size_t(row / 2) * width;
+      return { y, uv, uv + 1, 1, 2 };
+    }
+    default: {
+      const uint8_t* u = data + luma + size_t(row / 2) * (width / 2);
+      return { y, u, u + luma / 4, 1, 1 };
+    }
+  }
+}
+
+} // namespace
+
+bool yuv_on_gpu(pixel_format format, const frame_layout& layout) {
+  if ((format == PIXEL_FORMAT_YUYV || format == PIXEL_FORMAT_UYVY) &&
+      layout.stride % 4)
+    return false;
+  return shaders_supported() && program_for(format).program;
+}
+
+void upload_yuv_texture(GLuint texture, const uint8_t* data,
+                        int width, int height, pixel_format format,
+                        const frame_layout& layout) {
+  yuv_texture& t = textures()[texture];
+  t.format = format;
+  t.texels = float(width / 2);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  if (format == PIXEL_FORMAT_YUYV || format == PIXEL_FORMAT_UYVY) {
+    frame_layout texels = layout;
+    texels.x /= 2;
+    unpack_layout unpack(texels, 4);
+    upload_texture_image(texture, GL_RGBA, width / 2, height,
+        GL_RGBA, GL_UNSIGNED_BYTE, data);
+    // Each texel holds two pixels, which must not be blended
+    set_filter(GL_NEAREST);
+  } else {
+    upload_texture_image(texture, GL_LUMINANCE, width, height,
+        GL_LUMINANCE, GL_UNSIGNED_BYTE, data);
+    set_filter(GL_LINEAR);
+
+    if (!t.chroma_texture)
+      glGenTextures(1, &t.chroma_texture);
+    const uint8_t* chroma = data + size_t(width) * height;
+    if (format == PIXEL_FORMAT_NV12) {
+      upload_texture_image(t.chroma_texture, GL_LUMINANCE_ALPHA,
+          width / 2, height / 2, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, chroma);
+    } else {
+      upload_texture_image(t.chroma_texture, GL_LUMINANCE,
+          width / 2, height, GL_LUMINANCE, GL_UNSIGNED_BYTE, chroma);
+    }
+    // Chroma is shared by 2x2 pixels, as in the CPU conversion; for I420
+    // interpolating would also mix U and V across the seam between them
+    set_filter(GL_NEAREST);
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void forget_yuv_texture(GLuint texture) {
+  std::map<GLuint, yuv_texture>& all = textures();
+  auto it = all.find(texture);
+  if (it == all.end())
+    return;
+  if (it->second.chroma_texture) {
+    forget_texture_storage(it->second.chroma_texture);
+    glDeleteTextures(1, &it->second.chroma_texture);
+  }
+  all.erase(it);
+}
+
+bool begin_yuv_draw(GLuint texture) {
+  std::map<GLuint, yuv_texture>& all = textures();
+  auto it = all.find(texture);
+  if (it == all.end())
+    return false;
+  const yuv_program& p = program_for(it->second.format);
+  glUseProgram(p.program);
+  if (p.texels >= 0)
+    glUniform1f(p.texels, it->second.texels);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, it->second.chroma_texture);
+  glActiveTexture(GL_TEXTURE0);
+  return true;
+}
+
+void end_yuv_draw() {
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glUseProgram(0);
+}
+
+void convert_yuv_to_rgba(uint8_t* rgba, const uint8_t* data,
+                         int width, int height, pixel_format format,
+                         size_t stride) {
+  if (!stride)
+    stride = size_t(width) * 2;
+  // Bands of whole chroma rows
+  const unsigned bands = unsigned(std::max<size_t>(1, std::min<size_t>(
+      std::min<size_t>(worker_pool::instance().size(), height / 2),
+      size_t(width) * height / kMinBandPixels)));
+  auto convert_band = [&](unsigned b) {
+    const int begin = height / 2 * b / bands * 2;
+    const int end = b + 1 == bands ? height : height / 2 * (b + 1) / bands * 2;
+    for (int row = begin; row < end; row++) {
+      convert_row(rgba + size_t(row) * width * 4,
+          frame_row(data, width, height, format, stride, row), width);
+    }
+  };
+  if (bands <= 1)
+    convert_band(0);
+  else
+    worker_pool::instance().run(bands, convert_band);
+}
+
+const char* yuv_kernel_name() {
+  return kKernelName;
+}
+
+} // namespace glfw
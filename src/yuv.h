@@ -0,0 +1,52 @@
+/*
+ * yuv.h
+ *
+ */
+
+#ifndef YUV_H_
+#define YUV_H_
+
+#include "pixel_format.h"
+
+#include <cstdint>
+
+namespace glfw {
+
+// YUYV, UYVY, NV12 and I420 (BT.601, limited range)
+constexpr bool is_yuv_format(pixel_format format) {
+  return format >= PIXEL_FORMAT_YUYV && format <= PIXEL_FORMAT_I420;
+}
+
+// True where frames of format, laid out as given, can be uploaded as is and
+// converted in a shader. Packed frames go up as RGBA texels of two pixels,
+// so their stride must be a whole number of texels.
+bool yuv_on_gpu(pixel_format format,
+                const frame_layout& layout = frame_layout());
+
+// Upload the planes of a YUV frame unchanged: the luma (or the packed
+// frame) into texture, the chroma of planar formats into a companion
+// texture. Leaves nothing bound.
+void upload_yuv_texture(GLuint texture, const uint8_t* data,
+                        int width, int height, pixel_format format,
+                        const frame_layout& layout);
+
+// texture no longer holds YUV planes
+void forget_yuv_texture(GLuint texture);
+
+// If texture holds YUV planes, bind the converting program and the chroma
+// texture so that drawing with texture bound on unit 0 yields RGB. Returns
+// false, and binds nothing, for ordinary textures.
+bool begin_yuv_draw(GLuint texture);
+void end_yuv_draw();
+
+// CPU fallback: convert a frame to width * height RGBA pixels. Rows of
+// packed formats are stride bytes apart (0 when tightly packed).
+void convert_yuv_to_rgba(uint8_t* rgba, const uint8_t* data,
+                         int width, int height, pixel_format format,
+                         size_t stride = 0);
+
+const char* yuv_kernel_name();
+
+} // namespace glfw
+
+#endif /* YUV_H_ */
@@ -0,0 +1,141 @@
+// deprojectDepth against a plain JavaScript port of librealsense's
+// rs2_deproject_pixel_to_point, rs2_transform_point_to_point and
+// rs2_project_point_to_pixel, for each distortion model. Needs no window.
+var glfw = require('../index');
+var assert = require('assert');
+var log = console.log;
+
+var NONE = 0, MODIFIED = 1, INVERSE = 2, BROWN = 4;
+
+// rs2_deproject_pixel_to_point
+function deproject(intrin, px, py, depth) {
+  var x = (px - intrin.ppx) / intrin.fx;
+  var y = (py - intrin.ppy) / intrin.fy;
+  var c = intrin.coeffs;
+  var r2, f;
+  if (intrin.model == INVERSE) {
+    r2 = x * x + y * y;
+    f = 1 + c[0] * r2 + c[1] * r2 * r2 + c[4] * r2 * r2 * r2;
+    var ux = x * f + 2 * c[2] * x * y + c[3] * (r2 + 2 * x * x);
+    var uy = y * f + 2 * c[3] * x * y + c[2] * (r2 + 2 * y * y);
+    x = ux;
+    y = uy;
+  } else if (intrin.model == BROWN) {
+    var xo = x, yo = y;
+    for (var i = 0; i < 10; i++) {
+      r2 = x * x + y * y;
+      var icdist = 1 / (1 + ((c[4] * r2 + c[1]) * r2 + c[0]) * r2);
+      var xq = x / icdist, yq = y / icdist;
+      var dx = 2 * c[2] * xq * yq + c[3] * (r2 + 2 * xq * xq);
+      var dy = 2 * c[3] * xq * yq + c[2] * (r2 + 2 * yq * yq);
+      x = (xo - dx) * icdist;
+      y = (yo - dy) * icdist;
+    }
+  }
+  return [x * depth, y * depth, depth];
+}
+
+// rs2_transform_point_to_point, rotation column major
+function transform(extrin, p) {
+  var r = extrin.rotation, t = extrin.translation;
+  return [
+    r[0] * p[0] + r[3] * p[1] + r[6] * p[2] + t[0],
+    r[1] * p[0] + r[4] * p[1] + r[7] * p[2] + t[1],
+    r[2] * p[0] + r[5] * p[1] + r[8] * p[2] + t[2]
+  ];
+}
+
+// rs2_project_point_to_pixel; the inverse model projects as the modified one
+function project(intrin, p) {
+  var x = p[0] / p[2], y = p[1] / p[2];
+  var c = intrin.coeffs;
+  var r2, f;
+  if (intrin.model == MODIFIED || intrin.model == INVERSE) {
+    r2 = x * x + y * y;
+    f = 1 + c[0] * r2 + c[1] * r2 * r2 + c[4] * r2 * r2 * r2;
+    x *= f;
+    y *= f;
+    var dx = x + 2 * c[2] * x * y + c[3] * (r2 + 2 * x * x);
+    var dy = y + 2 * c[3] * x * y + c[2] * (r2 + 2 * y * y);
+    x = dx;
+    y = dy;
+  } else if (intrin.model == BROWN) {
+    r2 = x * x + y * y;
+    f = 1 + c[0] * r2 + c[1] * r2 * r2 + c[4] * r2 * r2 * r2;
+    var xf = x * f, yf = y * f;
+    var bx = xf + 2 * c[2] * x * y + c[3] * (r2 + 2 * x * x);
+    var by = yf + 2 * c[3] * x * y + c[2] * (r2 + 2 * y * y);
+    x = bx;
+    y = by;
+  }
+  return [x * intrin.fx + intrin.ppx, y * intrin.fy + intrin.ppy];
+}
+
+function intrinsics(width, height, model) {
+  return {
+    width: width, height: height, ppx: width / 2 - 0.7, ppy: height / 2 + 0.4,
+    fx: width * 0.9, fy: width * 0.88, model: model,
+    coeffs: model == NONE ? [0, 0, 0, 0, 0] :
+        [0.12, -0.25, 0.004, -0.006, 0.08]
+  };
+}
+
+var identity = { rotation: [1, 0, 0, 0, 1, 0, 0, 0, 1], translation: [0, 0, 0] };
+// A few degrees about y, then 15 mm along x
+var c = Math.cos(0.05), s = Math.sin(0.05);
+var moved = {
+  rotation: [c, 0, -s, 0, 1, 0, s, 0, c],
+  translation: [0.015, -0.002, 0.001]
+};
+
+var width = 24, height = 18, scale = 0.001;
+var depth = new Uint16Array(width * height);
+for (var i = 0; i < depth.length; i++)
+  depth[i] = i % 7 == 3 ? 0 : 400 + (i * 37) % 3000;
+var withDepth = 0;
+for (i = 0; i < depth.length; i++)
+  if (depth[i]) withDepth++;
+
+function check(name, depthModel, colorModel, extrin) {
+  var depthIntrin = intrinsics(width, height, depthModel);
+  var colorIntrin = colorModel === undefined ? undefined :
+      intrinsics(32, 24, colorModel);
+  var vertices = new Float32Array(width * height * 3);
+  var texCoords = new Float32Array(width * height * 2);
+  var n = glfw.deprojectDepth(depth, scale, depthIntrin, vertices, texCoords,
+      colorIntrin, extrin);
+  assert.equal(n, withDepth, name + ": count of pixels with depth");
+
+  var target = colorIntrin || depthIntrin;
+  for (var py = 0; py < height; py++) {
+    for (var px = 0; px < width; px++) {
+      var i = py * width + px;
+      var at = name + " at " + px + "," + py;
+      if (!depth[i]) {
+        assert.deepEqual([vertices[i * 3], vertices[i * 3 + 1],
+            vertices[i * 3 + 2], texCoords[i * 2], texCoords[i * 2 + 1]],
+            [0, 0, 0, 0, 0], at + ": hole not zeroed");
+        continue;
+      }
+      var p = deproject(depthIntrin, px, py, depth[i] * scale);
+      for (var k = 0; k < 3; k++)
+        assert(Math.abs(vertices[i * 3 + k] - p[k]) < 1e-5,
+            at + ": vertex " + vertices[i * 3 + k] + " != " + p[k]);
+      var pixel = project(target, transform(extrin || identity, p));
+      var u = pixel[0] / target.width, v = pixel[1] / target.height;
+      assert(Math.abs(texCoords[i * 2] - u) < 1e-4,
+          at + ": u " + texCoords[i * 2] + " != " + u);
+      assert(Math.abs(texCoords[i * 2 + 1] - v) < 1e-4,
+          at + ": v " + texCoords[i * 2 + 1] + " != " + v);
+    }
+  }
+}
+
+check("no distortion", NONE);
+check("no distortion, into color", NONE, NONE, moved);
+check("Brown-Conrady", BROWN, BROWN, moved);
+check("inverse Brown-Conrady depth, modified color", INVERSE, MODIFIED, moved);
+check("inverse Brown-Conrady color", NONE, INVERSE, moved);
+
+log("deproject: ok");
+process.exit(0);
@@ -0,0 +1,53 @@
+// Frames that share a frame number but come from different streams, or are
+// different crops of one buffer, must not be taken for one another when they
+// are drawn through the same texture.
+var glfw = require('../index');
+var assert = require('assert');
+var log = console.log;
+
+if (!glfw.Init()) {
+  log("Failed to initialize GLFW");
+  process.exit(-1);
+}
+
+glfw.DefaultWindowHints();
+glfw.WindowHint(glfw.VISIBLE, 0);
+var window = glfw.CreateGLFWWindow(64, 64, "Frame cache");
+if (!window) {
+  log("Failed to open GLFW window");
+  glfw.Terminate();
+  process.exit(-1);
+}
+glfw.MakeContextCurrent(window);
+
+var width = 4, height = 4;
+var cameraA = new Uint16Array(width * height);
+var cameraB = new Uint16Array(width * height);
+var misses = function() { return glfw.getFrameCacheStats().misses; };
+var draw = function(buffer, options) {
+  glfw.drawImage2D(0, 0, 64, 64, 'z16', buffer, width, height, options);
+};
+
+// Two cameras on their first frame
+var before = misses();
+draw(cameraA, { frame: 1 });
+draw(cameraB, { frame: 1 });
+assert.equal(misses() - before, 2, "second camera reused the first's frame");
+
+// The same frame again is a hit
+before = misses();
+draw(cameraB, { frame: 1 });
+assert.equal(misses() - before, 0, "unchanged frame was uploaded again");
+
+// Two crops of one frame
+var wide = new Uint16Array(width * 2 * height);
+var stride = width * 2 * 2;
+before = misses();
+draw(wide, { frame: 7, stride: stride, x: 0 });
+draw(wide, { frame: 7, stride: stride, x: width });
+assert.equal(misses() - before, 2, "second crop reused the first crop");
+
+log("frame cache: ok");
+glfw.DestroyWindow(window);
+glfw.Terminate();
+process.exit(0);
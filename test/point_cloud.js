@@ -0,0 +1,75 @@
+// drawDepthAndColorAsPointCloud draws, and counts, only the points with a
+// depth. Point counts around a multiple of 8 take both the vector loop and
+// the scalar tail of the compaction kernel, with the vertex buffers sized
+// exactly so that the last point sits at their very end.
+var glfw = require('../index');
+var assert = require('assert');
+var log = console.log;
+
+if (!glfw.Init()) {
+  log("Failed to initialize GLFW");
+  process.exit(-1);
+}
+
+glfw.DefaultWindowHints();
+glfw.WindowHint(glfw.VISIBLE, 0);
+var window = glfw.CreateGLFWWindow(64, 64, "Point cloud");
+if (!window) {
+  log("Failed to open GLFW window");
+  glfw.Terminate();
+  process.exit(-1);
+}
+glfw.MakeContextCurrent(window);
+
+var color = new Uint8Array(2 * 2 * 3);
+
+// Holes (0 and -0) and NaN depths among the points; NaN is not a hole
+function depthOf(i, count) {
+  if (i == count - 1)
+    return count % 2 ? 0 : 1.5;
+  switch (i % 5) {
+    case 1: return 0;
+    case 2: return -0;
+    case 3: return i % 3 ? 0.5 + i / count : NaN;
+    default: return 0.25 + i / count;
+  }
+}
+
+function check(count) {
+  var vertices = new Float32Array(count * 3);
+  var texCoords = new Float32Array(count * 2);
+  var expected = 0;
+  for (var i = 0; i < count; i++) {
+    var z = depthOf(i, count);
+    vertices[i * 3] = i;
+    vertices[i * 3 + 1] = -i;
+    vertices[i * 3 + 2] = z;
+    texCoords[i * 2] = i / count;
+    texCoords[i * 2 + 1] = 1 - i / count;
+    if (z != 0)
+      expected++;
+  }
+  var n = glfw.drawDepthAndColorAsPointCloud(window, vertices, count,
+      texCoords, color, 2, 2, 'rgb8');
+  assert.equal(n, expected, count + " points: count of points with depth");
+}
+
+[1, 8, 9, 16, 17, 8000, 8001, 8192, 8193].forEach(check);
+
+// Fewer points than the buffers hold
+var vertices = new Float32Array(16 * 3);
+var texCoords = new Float32Array(16 * 2);
+for (var i = 0; i < 16; i++)
+  vertices[i * 3 + 2] = 1;
+assert.equal(glfw.drawDepthAndColorAsPointCloud(window, vertices, 9,
+    texCoords, color, 2, 2, 'rgb8'), 9, "points past the count were drawn");
+
+assert.throws(function() {
+  glfw.drawDepthAndColorAsPointCloud(window, vertices, 17, texCoords, color,
+      2, 2, 'rgb8');
+}, RangeError, "more points than vertices");
+
+log("point cloud: ok");
+glfw.DestroyWindow(window);
+glfw.Terminate();
+process.exit(0);